@@ -1,693 +1,6039 @@
-#include <iostream>
-#include <vector>
-#include <unordered_map>
-#include <unordered_set>
-#include <string>
-#include <algorithm>
-#include <stack>
-#include <sstream>
-
-using namespace std;
-
-class CarbonNode {
-public:
-    int id;
-    int C_C_bonds = 0;
-    int C_H_bonds = 0;
-    int C_X_bonds = 0;
-    string label;
-
-    CarbonNode() : id(0), label("C") {}
-
-    CarbonNode(int id, const string& label = "C") : id(id), label(label) {}
-
-    void incrementC_C() { C_C_bonds++; }
-    void incrementC_H(int numH) { C_H_bonds = numH; }
-    void incrementC_X() { C_X_bonds++; }
-
-    int getTotalBonds() const { return C_C_bonds + C_H_bonds + C_X_bonds; }
-
-    void printInfo() const {
-        cout << label << id << ": C-C=" << C_C_bonds << ", C-H=" << C_H_bonds << ", C-X=" << C_X_bonds << "; ";
-    }
-};
-
-class MolecularGraph {
-public:
-    unordered_map<int, CarbonNode> carbons;
-    unordered_map<int, vector<int>> adjacencyList;
-    vector<pair<int, int>> edges;
-    vector<pair<string, string>> input;
-    
-    int counter = 1;
-
-    void addCarbon(const string& label) {
-        carbons[counter] = CarbonNode(counter, label);
-        counter++;
-    }
-
-    void addEdge(int id1, int id2) {
-        carbons[id1].incrementC_C();
-        carbons[id2].incrementC_C();
-        edges.emplace_back(id1, id2);
-        adjacencyList[id1].push_back(id2);
-        adjacencyList[id2].push_back(id1);
-    }
-
-    void parseMolecularFormula(const string& formula) {
-        stack<int> branchPoints;
-        int previousCarbon = 0;
-
-        for (size_t i = 0; i < formula.size();) {
-            char ch = formula[i];
-
-            // --- Handle COOH Group ---
-            if (i + 3 < formula.size() && formula.substr(i, 4) == "COOH") {
-                addCarbon("COOH");
-                int currentCarbon = counter - 1;
-                if (previousCarbon != 0) addEdge(previousCarbon, currentCarbon);
-                previousCarbon = currentCarbon;
-                i += 4;
-                continue;
-            }
-
-            // --- Handle Carbon Atoms ---
-            if (ch == 'C') {
-                addCarbon("C");
-                int currentCarbon = counter - 1;
-                i++;
-
-                // Check for H (e.g., CH3)
-                if (i < formula.size() && formula[i] == 'H') {
-                    int numH = 1;
-                    i++;
-                    if (i < formula.size() && isdigit(formula[i])) {
-                        numH = formula[i] - '0';
-                        i++;
-                    }
-                    carbons[currentCarbon].incrementC_H(numH);
-                }
-
-                // Check for Cl, Br, F, I right after CHx
-                if (i + 1 < formula.size()) {
-                    string next2 = formula.substr(i, 2);
-                    if (next2 == "Cl" || next2 == "Br") {
-                        carbons[currentCarbon].incrementC_X();
-                        i += 2;
-                    } else if (formula[i] == 'F' || formula[i] == 'I') {
-                        carbons[currentCarbon].incrementC_X();
-                        i++;
-                    }
-                }
-
-                if (previousCarbon != 0) {
-                    addEdge(previousCarbon, currentCarbon);
-                }
-                previousCarbon = currentCarbon;
-                continue;
-            }
-
-            // --- Handle Branch Start ---
-            if (ch == '(') {
-                branchPoints.push(previousCarbon);
-                i++;
-                continue;
-            }
-
-            // --- Handle Branch End ---
-            if (ch == ')') {
-                if (!branchPoints.empty()) {
-                    previousCarbon = branchPoints.top();
-                    branchPoints.pop();
-                }
-                i++;
-                continue;
-            }
-
-            // --- Handle Halogen as Direct Label (e.g., CH3CH2CH(Cl)CH3) ---
-            if (isalpha(ch)) {
-                string halogenLabel(1, ch);
-                if (i + 1 < formula.size() && islower(formula[i + 1])) {
-                    halogenLabel += formula[i + 1];
-                }
-
-                if (halogenLabel == "Cl" || halogenLabel == "Br") {
-                    if (previousCarbon != 0) {
-                        carbons[previousCarbon].incrementC_X();
-                    }
-                    i += 2;
-                } else if (ch == 'F' || ch == 'I') {
-                    if (previousCarbon != 0) {
-                        carbons[previousCarbon].incrementC_X();
-                    }
-                    i++;
-                } else {
-                    // Unknown label – treat as separate carbon or atom (fallback)
-                    addCarbon(halogenLabel);
-                    int currentAtom = counter - 1;
-                    if (previousCarbon != 0) {
-                        addEdge(previousCarbon, currentAtom);
-                    }
-                    previousCarbon = currentAtom;
-                    i += halogenLabel.length();
-                }
-            } else {
-                i++; // Skip unknown or malformed characters
-            }
-        }
-    }
-
-    bool hasCyclicEdge() {
-        vector<int> candidates;
-        for (const auto& pair : carbons) {
-            if (pair.second.getTotalBonds() == 3) {
-                candidates.push_back(pair.first);
-            }
-        }
-
-        if (candidates.size() >= 2) {
-            addEdge(candidates[0], candidates[1]);
-            cout << "Added cyclic edge between nodes " << candidates[0] << " and " << candidates[1] << endl;
-            cout << endl;
-            return true;
-        }
-        return false;
-    }
-
-    void printAtomsInfo() const {
-        cout << "Atoms Info" << endl;
-        for (const auto& pair : carbons) {
-            pair.second.printInfo();
-            cout << endl;
-        }
-        cout << endl;
-    }
-
-    void printEdges()
-    {
-        cout << "Edges" << endl;
-        for (const auto& edge : edges) {
-            cout << carbons.at(edge.first).label << edge.first << "-"
-                 << carbons.at(edge.second).label << edge.second << endl;
-            
-            string label1 = carbons.at(edge.first).label + to_string(edge.first);
-            string label2 = carbons.at(edge.second).label + to_string(edge.second);
-            input.emplace_back(label1, label2);
-        }
-        cout << endl;
-    }
-};
-
-// -------------------- Helper Functions --------------------
-
-// Graph represented as an adjacency list
-unordered_map<int, vector<int>> graph;
-
-// Function to add an edge to the graph
-void addEdge(int u, int v) {
-    graph[u].push_back(v);
-    graph[v].push_back(u);
-}
-
-// Modified DFS to track path
-pair<int, vector<int>> dfsWithConditions(int node, unordered_set<int>& visited, const unordered_set<int>& ignoredNodes) {
-    visited.insert(node);
-    int maxLength = 0;
-    vector<int> longestPath = {node};
-
-    for (int neighbor : graph[node]) {
-        if (visited.find(neighbor) == visited.end() && ignoredNodes.find(neighbor) == ignoredNodes.end()) {
-            pair<int, vector<int>> res = dfsWithConditions(neighbor, visited, ignoredNodes);
-            int length = res.first;
-            vector<int> path = res.second;
-
-            if (length + 1 > maxLength) {
-                maxLength = length + 1;
-                longestPath = {node};
-                longestPath.insert(longestPath.end(), path.begin(), path.end());
-            }
-        }
-    }
-    visited.erase(node); // Backtrack
-    return {maxLength, longestPath};
-}
-
-// Function to find the longest carbon chain with path tracking
-vector<int> findLongestCarbonChain(int startNode, const unordered_set<int>& ignoredNodes) {
-    unordered_set<int> visited;
-
-    // Step 1: First DFS to find the farthest node from startNode
-    pair<int, vector<int>> res1 = dfsWithConditions(startNode, visited, ignoredNodes);
-    vector<int> farthestNodePath = res1.second;
-
-    int farthestNode = farthestNodePath.back();
-
-    // Step 2: Second DFS from the farthest node found in the first DFS
-    visited.clear();
-    pair<int, vector<int>> res2 = dfsWithConditions(farthestNode, visited, ignoredNodes);
-    vector<int> longestChainPath = res2.second;
-
-    return longestChainPath; // Returns the path (chain of nodes) in one direction
-}
-
-vector<int> getOptimalChainDirection(const vector<int>& chain, const unordered_map<int, vector<pair<int, int>>>& branchInfo) {
-    vector<int> leftLocants, rightLocants;
-
-    // Calculate left-to-right locants for branches
-    for (size_t i = 0; i < chain.size(); i++) {
-        int atom = chain[i];
-        if (branchInfo.find(atom) != branchInfo.end()) {
-            leftLocants.push_back(i + 1); // Locants from left side
-        }
-    }
-
-    // Calculate right-to-left locants for branches
-    for (size_t i = 0; i < chain.size(); i++) {
-        int atom = chain[chain.size() - i - 1];
-        if (branchInfo.find(atom) != branchInfo.end()) {
-            rightLocants.push_back(i + 1); // Locants from right side
-        }
-    }
-
-    // Perform lexicographical comparison
-    if (leftLocants < rightLocants) {
-        return chain; // Left-to-right is lexicographically smaller
-    } else {
-        return vector<int>(chain.rbegin(), chain.rend()); // Reverse for right-to-left
-    }
-}
-
-
-string formatBranchName(int numCarbons, int halogenType) {
-    // For halogens, return just the halogen name
-    if (halogenType > 0) {
-        switch (halogenType) {
-            case 1: return "chloro";
-            case 2: return "bromo";
-            case 3: return "fluoro";
-            case 4: return "iodo";
-            default: return "halo";
-        }
-    }
-
-    // For alkyl branches
-    string branchName;
-    if (numCarbons == 1) {
-        branchName = "methyl";
-    } else if (numCarbons == 2) {
-        branchName = "ethyl";
-    } else if (numCarbons == 3) {
-        branchName = "propyl";
-    } else if (numCarbons == 4) {
-        branchName = "butyl";
-    }
-
-    return branchName;
-}
-
-
-/// Helper function to combine branches with identical names and add prefixes for duplicates
-vector<string> combineBranches(const vector<string>& branches) {
-    vector<string> combinedBranches;
-    int i = 0;
-
-    while (i < branches.size()) {
-        // Extract locant and branch name
-        size_t dashPos = branches[i].find('-');
-        string locant = branches[i].substr(0, dashPos);
-        string branchName = branches[i].substr(dashPos + 1);
-
-        vector<string> locants = {locant};
-
-        // Check for identical consecutive branch names and collect their locants
-        while (i + 1 < branches.size() && branches[i + 1].find("-" + branchName) != string::npos) {
-            size_t nextDashPos = branches[i + 1].find('-');
-            string nextLocant = branches[i + 1].substr(0, nextDashPos);
-            locants.push_back(nextLocant);
-            i++;
-        }
-
-        // Combine locants if there are multiple, otherwise keep single locant
-        if (locants.size() > 1) {
-            string prefix = ""; // Prefix for naming based on the count
-            if (locants.size() == 2) {
-                prefix = "di";
-            } else if (locants.size() == 3) {
-                prefix = "tri";
-            } else if (locants.size() > 3) {
-                prefix = to_string(locants.size()) + "-";
-            }
-
-            string combinedLocants = "(" + locants[0];
-            for (size_t j = 1; j < locants.size(); j++) {
-                combinedLocants += "," + locants[j];
-            }
-            combinedLocants += ")";
-            combinedBranches.push_back(combinedLocants + "-" + prefix + branchName);
-        } else {
-            combinedBranches.push_back(locants[0] + "-" + branchName);
-        }
-
-        i++;
-    }
-
-    return combinedBranches;
-}
-
-
-
-string generateIUPACName(const vector<int>& longestChain, const unordered_map<int, string>& idToLabel, unordered_map<int, vector<pair<int, int>>>& branchInfo, int counter) {
-    int numCarbons = longestChain.size();
-    string chainName;
-    if (numCarbons == 1) chainName = "Meth";
-    else if (numCarbons == 2) chainName = "Eth";
-    else if (numCarbons == 3) chainName = "Prop";
-    else if (numCarbons == 4) chainName = "But";
-    else if (numCarbons == 5) chainName = "Pent";
-    else if (numCarbons == 6) chainName = "Hex";
-    else if (numCarbons == 7) chainName = "Hept";
-    else if (numCarbons == 8) chainName = "Oct";
-    else if (numCarbons == 9) chainName = "Non";
-    else if (numCarbons == 10) chainName = "Dec";
-
-    if(counter==0)
-    {
-        chainName = chainName + "ane";
-    }
-    else if (counter==1)
-    {
-        chainName = chainName + "an";
-    }
-    else if(counter==2)
-    {
-        chainName = chainName + "yl";
-    }
-    
-
-    // Generate branch names with locants
-    vector<string> branches;
-    for (size_t i = 0; i < longestChain.size(); i++) {
-        int atom = longestChain[i];
-        if (branchInfo.find(atom) != branchInfo.end()) {
-            // Process ALL branches for this atom
-            for (const pair<int, int>& branch : branchInfo[atom]) {
-                int numCarbonsInBranch = branch.first;
-                int halogenType = branch.second;
-                string branchName = formatBranchName(numCarbonsInBranch, halogenType);
-                int locant = i + 1;  // 1-based locant
-                branches.push_back(to_string(locant) + "-" + branchName);
-            }
-        }
-    }
-
-    // Sort branches by locants to ensure correct order
-    sort(branches.begin(), branches.end());
-
-    // Combine branches with identical names
-    vector<string> combinedBranches = combineBranches(branches);
-
-    // Combine branch information with the main chain name
-    string finalName;
-    for (const string& branch : combinedBranches) {
-        if (!finalName.empty()) finalName += "-";
-        finalName += branch;
-    }
-    if (!finalName.empty()) {
-        finalName += chainName;
-    } else {
-        finalName = chainName;
-    }
-
-    return finalName;
-}
-
-
-#include <stack>
-
-// Helper function to count carbons and detect halogens in a branch starting from a given node
-pair<int, int> countBranchCarbons(int start, const unordered_set<int>& mainChainNodes, const unordered_map<int, string>& idToLabel) {
-    unordered_set<int> visited;  // Track visited nodes within the branch
-    stack<int> toVisit;
-    toVisit.push(start);
-
-    int carbonCount = 0;
-    int halogenType = 0;  // 0 indicates no halogen; 1 for chlorine, 2 for bromine, etc.
-
-    // Iterative DFS to explore the branch fully
-    while (!toVisit.empty()) {
-        int node = toVisit.top();
-        toVisit.pop();
-
-        // Get the label for the current node
-        string label = idToLabel.at(node);
-
-        // Debugging print to see the label being processed
-        cout << "Processing label: " << label << endl;
-
-        // Check if the node is a carbon (must start with "C" followed by a number)
-        if (label[0] == 'C' && label.substr(1).find_first_not_of("0123456789") == string::npos) {
-            carbonCount++;
-        } 
-        // Check if the node is a halogen (specific labels that start with Cl, Br, F, I, etc.)
-        else if (label.substr(0, 2) == "Cl" && label.length() > 2 && isdigit(label[2]) && halogenType == 0) {
-            halogenType = 1;  // Chlorine
-        } else if (label.substr(0, 2) == "Br" && label.length() > 2 && isdigit(label[2]) && halogenType == 0) {
-            halogenType = 2;  // Bromine
-        } else if (label.substr(0, 1) == "F" && label.length() > 1 && isdigit(label[1]) && halogenType == 0) {
-            halogenType = 3;  // Fluorine
-        } else if (label.substr(0, 1) == "I" && label.length() > 1 && isdigit(label[1]) && halogenType == 0) {
-            halogenType = 4;  // Iodine
-        }
-        // Add more halogens as needed
-
-        // Debug print to check halogenType and carbonCount
-        cout << "Detected label: " << label << ", halogenType: " << halogenType << ", carbonCount: " << carbonCount << endl;
-
-        visited.insert(node);  // Mark this node as visited
-
-        // Explore neighbors to find other carbons in the branch
-        for (int neighbor : graph[node]) {
-            if (visited.find(neighbor) == visited.end() && mainChainNodes.find(neighbor) == mainChainNodes.end()) {
-                visited.insert(neighbor);  // Mark the neighbor as visited in the branch
-                toVisit.push(neighbor);
-            }
-        }
-    }
-
-    return {carbonCount, halogenType};
-}
-
-// Helper function to detect if a node is a COOH group (e.g., COOH1, COOH2)
-bool isCOOHGroup(const string& label) {
-    return label.substr(0, 4) == "COOH" && label.length() > 4 && isdigit(label[4]);
-}
-
-vector<int> findLongestChainWithCOOH(const unordered_set<int>& coohNodes, const unordered_set<int>& ignoredNodes) {
-    vector<int> longestChain;
-
-    for (int coohNode : coohNodes) {
-        unordered_set<int> visited;
-        // Start DFS from the COOH node
-        pair<int, vector<int>> res = dfsWithConditions(coohNode, visited, ignoredNodes);
-        vector<int> path = res.second;
-
-        // Keep track of the longest path found
-        if (path.size() > longestChain.size()) {
-            longestChain = path;
-        }
-    }
-
-    // If the COOH group is at the end of the chain, reverse the chain
-    // if (!longestChain.empty() && longestChain.back() == *coohNodes.begin()) {
-    reverse(longestChain.begin(), longestChain.end());
-    // }
-
-    return longestChain;
-}
-
-// Modify the function signature to return a string
-string processMolecularGraph(MolecularGraph& graph1, int hint) {
-    graph1.printAtomsInfo();
-    bool cycle = graph1.hasCyclicEdge();
-    if(cycle) return 0;
-    graph1.printEdges();
-
-    vector<pair<string, string>> edgeList = graph1.input;
-
-    int counter = 0;
-
-    unordered_map<string, int> labelToID;
-    unordered_map<int, string> idToLabel;
-    int currentID = 0;
-    unordered_set<int> coohNodes;  // Set to store COOH node IDs
-    unordered_map<int, vector<pair<int, int>>> branchInfo;
-
-    unordered_set<int> ignoredNodes;
-
-    // Assign IDs and build graph
-    for (const auto& edge : edgeList) {
-        string nodeA = edge.first;
-        string nodeB = edge.second;
-
-        if (labelToID.find(nodeA) == labelToID.end()) {
-            labelToID[nodeA] = currentID;
-            idToLabel[currentID] = nodeA;
-            currentID++;
-        }
-        if (labelToID.find(nodeB) == labelToID.end()) {
-            labelToID[nodeB] = currentID;
-            idToLabel[currentID] = nodeB;
-            currentID++;
-        }
-
-        int idA = labelToID[nodeA];
-        int idB = labelToID[nodeB];
-        addEdge(idA, idB);
-
-        // Check if the node is a COOH group
-        if (isCOOHGroup(nodeA)) {
-            coohNodes.insert(idA);
-        }
-        if (isCOOHGroup(nodeB)) {
-            coohNodes.insert(idB);
-        }
-
-        // Ignore non-carbon nodes for main chain detection
-        if (nodeA[0] != 'C') ignoredNodes.insert(idA);
-        if (nodeB[0] != 'C') ignoredNodes.insert(idB);
-    }
-
-    vector<int> carbonNodes;
-    for (const auto& pair : labelToID) {
-        if (pair.first[0] == 'C') {
-            carbonNodes.push_back(pair.second);
-        }
-    }
-
-    if (carbonNodes.empty()) {
-        cout << "No carbon atoms found in the input.\n";
-        return "";
-    }
-
-   // Step 1: If COOH group is found, find the longest chain starting from COOH
-    vector<int> longestChain;
-    if (!coohNodes.empty()) {
-        counter = 1;
-        longestChain = findLongestChainWithCOOH(coohNodes, ignoredNodes);
-    } else {
-        // If no COOH group, find the longest chain normally
-        int startNode = carbonNodes[0];
-        longestChain = findLongestCarbonChain(startNode, ignoredNodes);
-    }
-
-    // Step 2: Store branch information AND halogen information on the original chain
-    for (int atom : longestChain) {
-        // First, check for halogens directly on this carbon
-        int graphAtomId = -1;
-        string atomLabel = idToLabel[atom];
-        for (const auto& pair : graph1.carbons) {
-            if (pair.second.label + to_string(pair.second.id) == atomLabel) {
-                graphAtomId = pair.first;
-                break;
-            }
-        }
-
-        if (graphAtomId != -1) {
-            const CarbonNode& carbon = graph1.carbons[graphAtomId];
-            
-            if (carbon.C_X_bonds > 0) {
-                int halogenType = 1;  // Default to chlorine for now
-                
-                const string& label = carbon.label;
-                if (label.find("Cl") != string::npos) halogenType = 1;
-                else if (label.find("Br") != string::npos) halogenType = 2;
-                else if (label.find("F") != string::npos)  halogenType = 3;
-                else if (label.find("I") != string::npos)  halogenType = 4;
-                
-                branchInfo[atom].push_back(make_pair(0, halogenType));
-            }
-        }
-        
-        // Then check for carbon branches
-        for (int neighbor : graph[atom]) {
-            if (ignoredNodes.find(neighbor) == ignoredNodes.end() &&
-                find(longestChain.begin(), longestChain.end(), neighbor) == longestChain.end()) {
-                
-                // Neighbor is a branch starting point
-                pair<int, int> branch = countBranchCarbons(
-                    neighbor,
-                    unordered_set<int>(longestChain.begin(), longestChain.end()),
-                    idToLabel
-                );
-
-                // Add ALL branches (no more overwriting)
-                branchInfo[atom].push_back(branch);
-            }
-        }
-    }
-
-    // Step 3: Decide best direction using branch info (now includes halogens)
-    vector<int> optimalChain = getOptimalChainDirection(longestChain, branchInfo);
-
-    if (hint == 1) counter = 2;
-
-    // Print the longest carbon chain using node labels
-    cout << "Longest carbon chain: ";
-    for (int node : optimalChain) {
-        cout << idToLabel[node] << " ";
-    }
-    cout << endl;
-
-    // Step 4: Generate IUPAC name (append -oic acid if needed)
-    string iupacName = generateIUPACName(optimalChain, idToLabel, branchInfo, counter);
-    if (!coohNodes.empty()) {
-        iupacName += "oic acid";
-    }
-
-    // string iupacName = generateIUPACName(optimalChain, idToLabel, branchInfo, counter);
-    cout << "IUPAC Name: " << iupacName << endl;
-
-    return iupacName; // Return the IUPAC name for use in ethers
-}
-
-// Helper function to generate IUPAC name for a single molecular graph
-string generateIUPACNameForGraph(MolecularGraph& graph) {
-    return processMolecularGraph(graph, 1); // This will print atom info and IUPAC name internally
-    
-}
-
-int main() {
-    MolecularGraph graph;
-    string formula;
-    cout << "ENTER THE MOLECULAR FORMULA: ";
-    getline(cin, formula);
-    cout << endl;
-
-    size_t pos = formula.find('-');
-    if(pos != string::npos && pos + 2 < formula.length() && formula[pos + 1] == 'O' && formula[pos + 2] == '-') {
-        string f1 = formula.substr(0, pos);
-        string f2 = formula.substr(pos + 3);
-        
-        cout<<f1<<" "<<f2<<endl;
-
-        MolecularGraph g1, g2;
-        g1.parseMolecularFormula(f1);
-        g2.parseMolecularFormula(f2);
-        
-        string name1 = generateIUPACNameForGraph(g1);
-        string name2 = generateIUPACNameForGraph(g2);
-
-        // Ensure the smaller group name comes first
-        if (name1 > name2) {
-            swap(name1, name2);
-        }
-
-        cout << "IUPAC NAME: " << name1 << " " << name2 << " ether" << endl;
-        return 0;
-    }
-
-    graph.parseMolecularFormula(formula);
-    processMolecularGraph(graph, 0);
-
-    return 0;
-}
\ No newline at end of file
+#include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <stack>
+#include <sstream>
+#include <cstdint>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <map>
+#include <array>
+#include <random>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// -------------------- Element Tables --------------------
+
+// Elements the parser can place, in Hill order (C, H, then alphabetical)
+enum Element { ELEMENT_C, ELEMENT_H, ELEMENT_BR, ELEMENT_CL, ELEMENT_F, ELEMENT_I, ELEMENT_N, ELEMENT_O, ELEMENT_COUNT };
+
+struct ElementInfo {
+    const char* symbol;
+    double mass;  // standard atomic weight
+};
+
+const ElementInfo ELEMENTS[ELEMENT_COUNT] = {
+    {"C", 12.011}, {"H", 1.008}, {"Br", 79.904}, {"Cl", 35.45},
+    {"F", 18.998}, {"I", 126.904}, {"N", 14.007}, {"O", 15.999},
+};
+
+// Halogen types use formatBranchName's numbering: 1 Cl, 2 Br, 3 F, 4 I
+const Element HALOGEN_ELEMENTS[5] = {ELEMENT_C, ELEMENT_CL, ELEMENT_BR, ELEMENT_F, ELEMENT_I};
+
+// Atom kinds are one-byte codes: the Element codes, then the groups the
+// parser keeps as one atom (COOH, CHO, CN, the COO ester link), then any
+// other symbol the parser meets (S, Na, ...), interned on first use.
+// Group and element checks compare codes instead of label strings.
+typedef uint8_t AtomKind;
+const AtomKind KIND_COOH = ELEMENT_COUNT;
+const AtomKind KIND_CHO = ELEMENT_COUNT + 1;
+const AtomKind KIND_CN = ELEMENT_COUNT + 2;
+const AtomKind KIND_ESTER = ELEMENT_COUNT + 3;
+const AtomKind FIRST_INTERNED_KIND = ELEMENT_COUNT + 4;
+const int MAX_ATOM_KINDS = 256;
+const AtomKind KIND_OVERFLOW = MAX_ATOM_KINDS - 1;  // shared by symbols once the table is full
+
+struct AtomKindTable {
+    char symbols[MAX_ATOM_KINDS][8] = {};
+    atomic<int> count{0};
+    mutex lock;
+
+    AtomKindTable() {
+        for (int e = 0; e < ELEMENT_COUNT; e++) strcpy(symbols[e], ELEMENTS[e].symbol);
+        strcpy(symbols[KIND_COOH], "COOH");
+        strcpy(symbols[KIND_CHO], "CHO");
+        strcpy(symbols[KIND_CN], "CN");
+        strcpy(symbols[KIND_ESTER], "COO");
+        strcpy(symbols[KIND_OVERFLOW], "?");
+        count = FIRST_INTERNED_KIND;
+    }
+};
+
+AtomKindTable& atomKinds() {
+    static AtomKindTable table;
+    return table;
+}
+
+// Code for an atom symbol. Lookups are lock-free; a new symbol is written
+// under the lock and published by the release store of the count.
+AtomKind internAtomKind(const string& symbol) {
+    AtomKindTable& table = atomKinds();
+    int known = table.count.load(memory_order_acquire);
+    for (int k = 0; k < known; k++) {
+        if (symbol == table.symbols[k]) return k;
+    }
+    lock_guard<mutex> guard(table.lock);
+    int count = table.count.load(memory_order_relaxed);
+    for (int k = known; k < count; k++) {
+        if (symbol == table.symbols[k]) return k;
+    }
+    if (count == KIND_OVERFLOW || symbol.size() >= sizeof(table.symbols[0])) return KIND_OVERFLOW;
+    strcpy(table.symbols[count], symbol.c_str());
+    table.count.store(count + 1, memory_order_release);
+    return count;
+}
+
+const char* atomSymbol(AtomKind kind) {
+    return atomKinds().symbols[kind];
+}
+
+// Kinds whose atom belongs to the carbon chain: carbons and the carbon groups
+bool isChainCarbonKind(AtomKind kind) {
+    return kind == ELEMENT_C || kind == KIND_COOH || kind == KIND_CHO || kind == KIND_CN;
+}
+
+// -------------------- Group Table --------------------
+
+// What a formula token does to the molecule being parsed
+enum GroupType : uint8_t {
+    GROUP_CHAIN,        // an atom that joins the chain: C, CH3, COOH, CHO, CN and the COO / O links
+    GROUP_SUBSTITUENT,  // an atom hung off the current atom: OH, NH2
+    GROUP_HALOGEN,      // recorded on the current atom; a count may follow (CCl3)
+};
+
+struct GroupPattern {
+    const char* text;
+    GroupType type;
+    AtomKind kind;         // atom added for the group
+    uint8_t hydrogens;     // hydrogens on that atom's record
+    uint8_t halogenType;   // formatBranchName's numbering, halogens only
+    uint8_t bonds;         // bonds a chain group uses once attached; 4 or more closes the chain
+    uint8_t carbons, formulaHydrogens, nitrogens, oxygens;  // what the group adds to the formula
+};
+
+// Every functional group the formula parser knows. Adding a group is adding
+// a row: GROUP_AUTOMATON is built from this table at compile time.
+constexpr GroupPattern GROUP_TABLE[] = {
+    {"C",    GROUP_CHAIN,        ELEMENT_C,  0, 0, 1, 1, 0, 0, 0},
+    {"CH",   GROUP_CHAIN,        ELEMENT_C,  1, 0, 2, 1, 1, 0, 0},
+    {"CH2",  GROUP_CHAIN,        ELEMENT_C,  2, 0, 3, 1, 2, 0, 0},
+    {"CH3",  GROUP_CHAIN,        ELEMENT_C,  3, 0, 4, 1, 3, 0, 0},
+    {"CH4",  GROUP_CHAIN,        ELEMENT_C,  4, 0, 5, 1, 4, 0, 0},
+    {"COOH", GROUP_CHAIN,        KIND_COOH,  0, 0, 4, 1, 1, 0, 2},
+    {"CHO",  GROUP_CHAIN,        KIND_CHO,   0, 0, 4, 1, 1, 0, 1},
+    {"CN",   GROUP_CHAIN,        KIND_CN,    0, 0, 4, 1, 0, 1, 0},
+    {"COO",  GROUP_CHAIN,        KIND_ESTER, 0, 0, 1, 1, 0, 0, 2},
+    {"O",    GROUP_CHAIN,        ELEMENT_O,  0, 0, 1, 0, 0, 0, 1},
+    {"-O-",  GROUP_CHAIN,        ELEMENT_O,  0, 0, 1, 0, 0, 0, 1},
+    {"OH",   GROUP_SUBSTITUENT,  ELEMENT_O,  1, 0, 0, 0, 1, 0, 1},
+    {"NH2",  GROUP_SUBSTITUENT,  ELEMENT_N,  2, 0, 0, 0, 2, 1, 0},
+    {"Cl",   GROUP_HALOGEN,      ELEMENT_CL, 0, 1, 0, 0, 0, 0, 0},
+    {"Br",   GROUP_HALOGEN,      ELEMENT_BR, 0, 2, 0, 0, 0, 0, 0},
+    {"F",    GROUP_HALOGEN,      ELEMENT_F,  0, 3, 0, 0, 0, 0, 0},
+    {"I",    GROUP_HALOGEN,      ELEMENT_I,  0, 4, 0, 0, 0, 0, 0},
+};
+const int GROUP_COUNT = sizeof(GROUP_TABLE) / sizeof(GROUP_TABLE[0]);
+
+// Trie over GROUP_TABLE as a dense transition table, built by the compiler.
+// Tokens are matched anchored at the parser's cursor, so no failure links
+// are needed: match() walks the transitions as far as the text allows and
+// returns the longest entry it passed (Cl over C, COOH over COO, CHO over CH).
+struct GroupAutomaton {
+    static constexpr int MAX_STATES = 64;
+    uint8_t next[MAX_STATES][128] = {};  // 0 = no transition; the root is never a target
+    int8_t accept[MAX_STATES] = {};      // table row + 1 ending at a state, 0 for none
+    int states = 1;
+
+    constexpr GroupAutomaton() {
+        for (int row = 0; row < GROUP_COUNT; row++) {
+            int state = 0;
+            for (const char* ch = GROUP_TABLE[row].text; *ch; ch++) {
+                if (next[state][(int)*ch] == 0) next[state][(int)*ch] = states++;
+                state = next[state][(int)*ch];
+            }
+            accept[state] = row + 1;
+        }
+    }
+
+    // Row of the longest table entry starting at text[i] (-1 if none); sets its length
+    int match(const string& text, size_t i, size_t& length) const {
+        int state = 0, row = -1;
+        for (size_t j = i; j < text.size() && (unsigned char)text[j] < 128; j++) {
+            state = next[state][(int)text[j]];
+            if (state == 0) break;
+            if (accept[state]) {
+                row = accept[state] - 1;
+                length = j - i + 1;
+            }
+        }
+        return row;
+    }
+};
+
+constexpr GroupAutomaton GROUP_AUTOMATON;
+static_assert(GROUP_AUTOMATON.states <= GroupAutomaton::MAX_STATES, "GROUP_TABLE needs more automaton states");
+
+// Halogen symbol starting at formula[i] (0 if none); sets its length in characters
+int halogenAt(const string& formula, size_t i, size_t& length) {
+    int row = GROUP_AUTOMATON.match(formula, i, length);
+    return row >= 0 && GROUP_TABLE[row].type == GROUP_HALOGEN ? GROUP_TABLE[row].halogenType : 0;
+}
+
+// Formula-level properties, accumulated per atom while parsing
+struct MolecularProperties {
+    int counts[ELEMENT_COUNT] = {};
+
+    void add(Element element, int n = 1) { counts[element] += n; }
+
+    void merge(const MolecularProperties& other) {
+        for (int e = 0; e < ELEMENT_COUNT; e++) counts[e] += other.counts[e];
+    }
+
+    int halogens() const {
+        return counts[ELEMENT_BR] + counts[ELEMENT_CL] + counts[ELEMENT_F] + counts[ELEMENT_I];
+    }
+
+    // Molecular formula in Hill order, e.g. C4H9Cl
+    string formula() const {
+        string result;
+        for (int e = 0; e < ELEMENT_COUNT; e++) {
+            if (counts[e] == 0) continue;
+            result += ELEMENTS[e].symbol;
+            if (counts[e] > 1) result += to_string(counts[e]);
+        }
+        return result;
+    }
+
+    double weight() const {
+        double total = 0;
+        for (int e = 0; e < ELEMENT_COUNT; e++) total += counts[e] * ELEMENTS[e].mass;
+        return total;
+    }
+
+    // Rings plus pi bonds: (2C + 2 + N - H - X) / 2
+    double unsaturation() const {
+        return (2 * counts[ELEMENT_C] + 2 + counts[ELEMENT_N] - counts[ELEMENT_H] - halogens()) / 2.0;
+    }
+
+    int heavyAtoms() const {
+        int total = 0;
+        for (int e = 0; e < ELEMENT_COUNT; e++) {
+            if (e != ELEMENT_H) total += counts[e];
+        }
+        return total;
+    }
+};
+
+// -------------------- Work Budget --------------------
+
+// Cooperative work budget for one naming run. The chain search and branch
+// analysis call spend() once per traversal step and unwind as soon as it
+// returns false, so pathological input is cut off after a bounded amount of
+// work instead of being killed from outside.
+struct WorkBudget {
+    long long maxSteps = 0;    // 0 = unlimited
+    long long deadlineMs = 0;  // 0 = no wall-clock deadline
+    long long steps = 0;
+    bool exceeded = false;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    bool spend(long long n = 1) {
+        if (exceeded) return false;
+        steps += n;
+        if (maxSteps > 0 && steps > maxSteps) {
+            exceeded = true;
+        } else if (deadlineMs > 0 && (steps & 255) < n && elapsedMs() > deadlineMs) {
+            // The clock is only read every 256 steps
+            exceeded = true;
+        }
+        return !exceeded;
+    }
+
+    long long elapsedMs() const {
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    }
+
+    // Steps still available (LLONG_MAX without a step limit)
+    long long stepsLeft() const { return maxSteps > 0 ? max(0LL, maxSteps - steps) : LLONG_MAX; }
+};
+
+// -------------------- Tracing --------------------
+
+// Debug dump policy of the naming pipeline. Traced functions take the policy
+// as a template parameter and guard every dump with
+// `if constexpr (Trace::enabled)`, so NoTrace instantiations contain no
+// tracing code at all. Interactive mode (whose dump the web page shows) uses
+// VerboseTrace; the tool modes use NoTrace. Building with -DIUPAC_NO_TRACE
+// turns VerboseTrace off too, leaving no tracing code in the binary; that is
+// the baseline --bench --baseline measures against.
+struct NoTrace {
+    static constexpr bool enabled = false;
+};
+
+struct VerboseTrace {
+#ifdef IUPAC_NO_TRACE
+    static constexpr bool enabled = false;
+#else
+    static constexpr bool enabled = true;
+#endif
+};
+
+// Atom flag bits: halogen count, halogen type (formatBranchName's numbering)
+// and the marker of a (CH2)n run node
+const uint8_t FLAG_HALOGEN_COUNT = 0x0f;
+const uint8_t FLAG_HALOGEN_TYPE = 0x70;
+const int FLAG_HALOGEN_TYPE_SHIFT = 4;
+const uint8_t FLAG_RUN = 0x80;
+const int HALOGEN_MIXED = 7;  // type field of an atom carrying more than one halogen type
+
+// Characters the repeat units of one formula may write out; beyond this the
+// formula is refused before any atom is built
+const long long MAX_REPEAT_EXPANSION = 1 << 20;
+// Largest repeat count a formula may write; larger or zero counts are parse errors
+const int MAX_REPEAT_COUNT = 100000000;
+
+// Halogen type carried by a flags byte (0 for none); untyped halogens default to chlorine
+int halogenTypeOf(uint8_t flags) {
+    if ((flags & FLAG_HALOGEN_COUNT) == 0) return 0;
+    int type = (flags & FLAG_HALOGEN_TYPE) >> FLAG_HALOGEN_TYPE_SHIFT;
+    return type > 0 ? type : 1;
+}
+
+// A parsed molecule. Atoms are packed records stored as parallel one-byte
+// arrays indexed by atom id (ids start at 1, slot 0 is unused): kind,
+// hydrogen count, degree (bonds to other atoms of the graph) and flags.
+// Counts saturate at what their field holds. Run lengths live in a side
+// table, since only (CH2)n nodes have one.
+class MolecularGraph {
+public:
+    vector<AtomKind> kinds;
+    vector<uint8_t> hydrogens;
+    vector<uint8_t> degrees;
+    vector<uint8_t> flags;
+    unordered_map<int, int> runs;  // atom id -> CH2 groups, for atoms flagged FLAG_RUN
+    unordered_map<int, array<uint8_t, 5>> mixedHalogens;  // atom id -> count per halogen type, for HALOGEN_MIXED atoms
+    vector<pair<int, int>> edges;
+    MolecularProperties properties;
+    
+    int counter = 1;  // id of the next atom
+    long long repeatSteps = 0;  // characters written out by repeat units, charged when the graph is named
+    bool oversized = false;     // repeat units would have written out too much; nothing was built
+    bool malformed = false;     // a repeat count was zero or above MAX_REPEAT_COUNT; nothing was built
+
+    MolecularGraph() : kinds(1), hydrogens(1), degrees(1), flags(1) {}
+
+    // Back to an empty molecule, keeping the allocations for the next one
+    void clear() {
+        kinds.resize(1);
+        hydrogens.resize(1);
+        degrees.resize(1);
+        flags.resize(1);
+        runs.clear();
+        mixedHalogens.clear();
+        edges.clear();
+        properties = MolecularProperties();
+        counter = 1;
+        repeatSteps = 0;
+        oversized = false;
+        malformed = false;
+    }
+
+    int addAtom(AtomKind kind) {
+        kinds.push_back(kind);
+        hydrogens.push_back(0);
+        degrees.push_back(0);
+        flags.push_back(0);
+        return counter++;
+    }
+
+    // Appends `count` atoms of kind 0 with empty records; returns the first id
+    int addAtoms(int count) {
+        int first = counter;
+        counter += count;
+        kinds.resize(counter);
+        hydrogens.resize(counter);
+        degrees.resize(counter);
+        flags.resize(counter);
+        return first;
+    }
+
+    void addEdge(int id1, int id2) {
+        if (degrees[id1] < UINT8_MAX) degrees[id1]++;
+        if (degrees[id2] < UINT8_MAX) degrees[id2]++;
+        edges.emplace_back(id1, id2);
+    }
+
+    void setHydrogens(int id, int count) { hydrogens[id] = min(count, (int)UINT8_MAX); }
+
+    // A second halogen type moves the atom's counts into mixedHalogens (CCl2Br)
+    void addHalogen(int id, int halogenType = 1) {
+        int count = min(halogenCount(id) + 1, (int)FLAG_HALOGEN_COUNT);
+        int carried = this->halogenType(id);
+        if (carried != 0 && carried != halogenType) {
+            array<uint8_t, 5>& counts = mixedHalogens[id];
+            if (carried != HALOGEN_MIXED) counts[carried] = halogenCount(id);
+            counts[halogenType]++;
+            halogenType = HALOGEN_MIXED;
+        }
+        flags[id] = (flags[id] & FLAG_RUN) | halogenType << FLAG_HALOGEN_TYPE_SHIFT | count;
+    }
+
+    void setRun(int id, int length) {
+        flags[id] |= FLAG_RUN;
+        runs[id] = length;
+    }
+
+    bool isCarbon(int id) const { return isChainCarbonKind(kinds[id]); }
+    int halogenCount(int id) const { return flags[id] & FLAG_HALOGEN_COUNT; }
+    int run(int id) const { return flags[id] & FLAG_RUN ? runs.at(id) : 1; }
+    int totalBonds(int id) const { return degrees[id] + hydrogens[id] + halogenCount(id); }
+    const char* label(int id) const { return atomSymbol(kinds[id]); }
+
+    // Halogen type carried by an atom (0 for none), in formatBranchName's numbering, or HALOGEN_MIXED
+    int halogenType(int id) const { return halogenTypeOf(flags[id]); }
+
+    // Halogens of one type on an atom
+    int halogenCount(int id, int halogenType) const {
+        int carried = this->halogenType(id);
+        if (carried == HALOGEN_MIXED) return mixedHalogens.at(id)[halogenType];
+        return carried == halogenType ? halogenCount(id) : 0;
+    }
+
+    // Per-type halogen counts of an atom packed four bits each, for hashing
+    uint64_t halogenKey(int id) const {
+        uint64_t key = 0;
+        for (int type = 1; type <= 4; type++) key |= (uint64_t)halogenCount(id, type) << 4 * type;
+        return key;
+    }
+
+    // Heap bytes held by the atoms, bonds and run table
+    size_t memoryBytes() const {
+        size_t runNode = sizeof(pair<const int, int>) + 2 * sizeof(void*);  // node plus bucket slot
+        return kinds.capacity() + hydrogens.capacity() + degrees.capacity() + flags.capacity() +
+               edges.capacity() * sizeof(edges[0]) + runs.size() * runNode +
+               mixedHalogens.size() * (sizeof(pair<const int, array<uint8_t, 5>>) + 2 * sizeof(void*));
+    }
+
+    // Repeat units may write out at most MAX_REPEAT_EXPANSION characters, and
+    // no more than `budget` has steps left for
+    void parseMolecularFormula(const string& text, const WorkBudget* budget = nullptr) {
+        size_t end;
+        for (size_t close = text.find(')'); close != string::npos; close = text.find(')', close + 1)) {
+            if (repeatCount(text, close, end) < 0) {
+                malformed = true;
+                return;
+            }
+        }
+        long long allowance = MAX_REPEAT_EXPANSION;
+        if (budget) allowance = min(allowance, budget->stepsLeft());
+        string formula;
+        if (!expandRepeatGroups(text, text.size() + allowance, formula)) {
+            oversized = true;
+            return;
+        }
+        repeatSteps = formula.size() > text.size() ? formula.size() - text.size() : 0;
+        stack<int> branchPoints;
+        int previousCarbon = 0;
+
+        for (size_t i = 0; i < formula.size();) {
+            char ch = formula[i];
+
+            // --- Handle (CH2)n Runs as one node ---
+            size_t runEnd;
+            int run = ch == '(' ? methyleneRun(formula, i, runEnd) : 0;
+            if (run > 0) {
+                int currentCarbon = addAtom(ELEMENT_C);
+                if (run > 1) setRun(currentCarbon, run);
+                setHydrogens(currentCarbon, 2);
+                properties.add(ELEMENT_C, run);
+                properties.add(ELEMENT_H, 2 * run);
+                if (previousCarbon != 0) addEdge(previousCarbon, currentCarbon);
+                previousCarbon = currentCarbon;
+                i = runEnd;
+                continue;
+            }
+
+            // --- Handle Groups: carbons, COOH, CHO, CN, OH, NH2, halogens, ester and ether links ---
+            size_t length;
+            int row = GROUP_AUTOMATON.match(formula, i, length);
+            if (row >= 0) {
+                const GroupPattern& group = GROUP_TABLE[row];
+                i += length;
+                if (group.type == GROUP_HALOGEN) {
+                    addHalogens(previousCarbon, group.halogenType, formula, i);
+                    continue;
+                }
+                properties.add(ELEMENT_C, group.carbons);
+                properties.add(ELEMENT_H, group.formulaHydrogens);
+                properties.add(ELEMENT_N, group.nitrogens);
+                properties.add(ELEMENT_O, group.oxygens);
+                int currentAtom = addAtom(group.kind);
+                setHydrogens(currentAtom, group.hydrogens);
+                if (previousCarbon != 0) addEdge(previousCarbon, currentAtom);
+                // A substituent leaves the chain where it was, unless it starts the formula
+                if (group.type == GROUP_CHAIN || previousCarbon == 0) previousCarbon = currentAtom;
+                continue;
+            }
+
+            // --- Handle Branch Start ---
+            if (ch == '(') {
+                branchPoints.push(previousCarbon);
+                i++;
+                continue;
+            }
+
+            // --- Handle Branch End ---
+            if (ch == ')') {
+                if (!branchPoints.empty()) {
+                    previousCarbon = branchPoints.top();
+                    branchPoints.pop();
+                }
+                i++;
+                continue;
+            }
+
+            if (isalpha(ch)) {
+                // Unknown label – treat as separate carbon or atom (fallback)
+                string label(1, ch);
+                if (i + 1 < formula.size() && islower(formula[i + 1])) {
+                    label += formula[i + 1];
+                }
+                for (int e = 0; e < ELEMENT_COUNT; e++) {
+                    if (label == ELEMENTS[e].symbol) properties.add((Element)e);
+                }
+                int currentAtom = addAtom(internAtomKind(label));
+                if (previousCarbon != 0) {
+                    addEdge(previousCarbon, currentAtom);
+                }
+                previousCarbon = currentAtom;
+                i += label.length();
+            } else {
+                i++; // Skip unknown or malformed characters
+            }
+        }
+    }
+
+    // Index of the ')' closing the '(' at formula[open], or npos
+    static size_t closingParenthesis(const string& formula, size_t open) {
+        int depth = 0;
+        for (size_t i = open; i < formula.size(); i++) {
+            if (formula[i] == '(') depth++;
+            else if (formula[i] == ')' && --depth == 0) return i;
+        }
+        return string::npos;
+    }
+
+    // Repeat count written after formula[close]: 0 if none, -1 if it is zero
+    // or above MAX_REPEAT_COUNT; `end` is set past it
+    static int repeatCount(const string& formula, size_t close, size_t& end) {
+        end = close + 1;
+        long long count = 0;
+        while (end < formula.size() && isdigit(formula[end])) {
+            if (count <= MAX_REPEAT_COUNT) count = count * 10 + (formula[end] - '0');
+            end++;
+        }
+        if (end == close + 1) return 0;
+        return count == 0 || count > MAX_REPEAT_COUNT ? -1 : (int)count;
+    }
+
+    // True if a repeated group closes off its attachment point (CH3, CH2Cl,
+    // CH(CH3)2, Cl) rather than continuing the chain (CH2, CH2CH(CH3)):
+    // its last top-level carbon has no free bond left
+    static bool isTerminalGroup(const string& group) {
+        int bonds = 4;  // a group without a top-level carbon (e.g. Cl) is terminal
+        for (size_t i = 0; i < group.size();) {
+            if (group[i] == '(') {
+                size_t close = closingParenthesis(group, i), end;
+                if (close == string::npos) break;
+                int count = repeatCount(group, close, end);
+                bonds += count > 0 ? count : 1;
+                i = end;
+                continue;
+            }
+            size_t length;
+            int row = GROUP_AUTOMATON.match(group, i, length);
+            if (row < 0) {
+                i++;
+                continue;
+            }
+            const GroupPattern& entry = GROUP_TABLE[row];
+            i += length;
+            if (entry.type == GROUP_CHAIN) {
+                bonds = entry.bonds;  // includes the bond to its predecessor or to the attachment point
+            } else {
+                int count = 1;
+                if (entry.type == GROUP_HALOGEN && i < group.size() && isdigit(group[i])) count = group[i++] - '0';
+                if (bonds < 4) bonds += count;
+            }
+        }
+        return bonds >= 4;
+    }
+
+    // Number of CH2 groups in a run written "(CH2)n" or "(CH2CH2...)n" at
+    // formula[open], or 0 if there is none; `end` is set past the count
+    static int methyleneRun(const string& formula, size_t open, size_t& end) {
+        size_t close = closingParenthesis(formula, open);
+        if (close == string::npos) return 0;
+        int count = repeatCount(formula, close, end);
+        size_t length = close - open - 1;
+        if (count <= 0 || length == 0 || length % 3 != 0) return 0;
+        for (size_t i = open + 1; i < close; i += 3) {
+            if (formula.compare(i, 3, "CH2") != 0) return 0;
+        }
+        return (int)min<long long>((long long)count * (length / 3), 1000000000);
+    }
+
+    // Rewrites repeat units other than (CH2)n runs: a terminal group becomes
+    // n branches (C(CH3)2 -> C(CH3)(CH3)) and any other unit is written out
+    // n times in the chain. (CH2)n runs are kept for the parser to read as
+    // one node, so their cost does not grow with n. Fails, before writing a
+    // unit out, if the result would grow past `limit` characters.
+    static bool expandRepeatGroups(const string& formula, size_t limit, string& result) {
+        result.clear();
+        if (formula.find('(') == string::npos) {
+            result = formula;
+            return result.size() <= limit;
+        }
+        string inner;
+        for (size_t i = 0; i < formula.size();) {
+            size_t close, end;
+            if (formula[i] != '(' || (close = closingParenthesis(formula, i)) == string::npos) {
+                result += formula[i++];
+                continue;
+            }
+            int count = repeatCount(formula, close, end);
+            if (!expandRepeatGroups(formula.substr(i + 1, close - i - 1), limit, inner)) return false;
+            if (count == 0 || methyleneRun(formula, i, end) > 0) {
+                result += "(" + inner + ")" + formula.substr(close + 1, end - close - 1);
+                i = end;
+                continue;
+            }
+            string unit = isTerminalGroup(inner) ? "(" + inner + ")" : inner;
+            if (result.size() > limit || (unsigned long long)unit.size() * count > limit - result.size()) return false;
+            for (int n = 0; n < count; n++) result += unit;
+            i = end;
+        }
+        return result.size() <= limit;
+    }
+
+    // Puts a halogen, or as many as the count after its symbol says (CCl3), on a carbon
+    void addHalogens(int carbon, int halogenType, const string& formula, size_t& i) {
+        int count = 1;
+        if (i < formula.size() && isdigit(formula[i])) {
+            count = formula[i] - '0';
+            i++;
+        }
+        properties.add(HALOGEN_ELEMENTS[halogenType], count);
+        if (carbon == 0) return;
+        for (int n = 0; n < count; n++) {
+            addHalogen(carbon, halogenType);
+        }
+    }
+
+    template <class Trace>
+    bool hasCyclicEdge() {
+        vector<int> candidates;
+        for (int id = 1; id < counter; id++) {
+            if (isCarbon(id) && totalBonds(id) == 3) {
+                candidates.push_back(id);
+            }
+        }
+
+        if (candidates.size() >= 2) {
+            addEdge(candidates[0], candidates[1]);
+            if constexpr (Trace::enabled) {
+                cout << "Added cyclic edge between nodes " << candidates[0] << " and " << candidates[1] << endl;
+                cout << endl;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    template <class Trace>
+    void printAtomsInfo() const {
+        if constexpr (!Trace::enabled) return;
+        cout << "Atoms Info" << endl;
+        for (int id = 1; id < counter; id++) {
+            cout << label(id) << id << ": C-C=" << (int)degrees[id] << ", C-H=" << (int)hydrogens[id]
+                 << ", C-X=" << halogenCount(id) << "; ";
+            if (run(id) > 1) cout << "run=" << run(id) << "; ";
+            cout << endl;
+        }
+        cout << endl;
+    }
+
+    template <class Trace>
+    void printEdges() const
+    {
+        if constexpr (!Trace::enabled) return;
+        cout << "Edges" << endl;
+        for (const auto& edge : edges) {
+            cout << label(edge.first) << edge.first << "-" << label(edge.second) << edge.second << endl;
+        }
+        cout << endl;
+    }
+};
+
+// -------------------- Decision Trace --------------------
+
+// Always-on record of what the engine decided, for explaining a wrong name
+// after the fact. Every thread writes fixed-size binary events into its own
+// ring buffer (no locks, no formatting, a few ns per event); the newest
+// DECISION_RING_EVENTS per thread survive. The rings are written to a file
+// on SIGUSR1, on a fatal signal and when an interactive run fails, and
+// --decision-decode renders such a file as text.
+enum DecisionEventType : uint16_t {
+    EVENT_THREAD = 1,       // a: thread number
+    EVENT_MOLECULE,         // formula: a = hash, b = first 8 bytes, small = length
+    EVENT_GRAPH,            // a = atoms, b = bonds
+    EVENT_RING_CLOSURE,     // a, b = atoms hasCyclicEdge joined
+    EVENT_CARBONS,          // a = carbons, small = COOH groups
+    EVENT_CHAIN_TARGET,     // a = carbons on the longest chains, b = substituents on the best of them
+    EVENT_CHAIN_STARTS,     // a = atoms kept at locant 1, b = their substituent count
+    EVENT_LOCANT,           // a = locant, b = partial chains kept, small = substituents at it
+    EVENT_TIED_CHAINS,      // a = chains left for the alphabetical rule
+    EVENT_ALPHABETICAL,     // a = winning chain among them
+    EVENT_CHAIN,            // a = nodes, b = first atom << 32 | last atom
+    EVENT_HALOGEN,          // a = atom, b = count, small = halogen type
+    EVENT_BRANCH,           // a = branch root, b = depth << 32 | substituents, small = root halogen type
+    EVENT_KERNEL,           // small = 1 if the small-molecule kernel named it, 0 if handed back
+    EVENT_NAME,             // a = length, b = hash
+    EVENT_BUDGET_EXCEEDED,  // b = steps
+    EVENT_TYPE_COUNT,
+};
+
+struct DecisionEvent {
+    uint16_t type;
+    uint16_t small;
+    uint32_t a;
+    uint64_t b;
+};
+static_assert(sizeof(DecisionEvent) == 16, "decision events are 16 bytes");
+
+const int DECISION_RING_EVENTS = 4096;  // power of two
+const int MAX_DECISION_RINGS = 256;
+const char DECISION_MAGIC[8] = {'O', 'C', 'T', 'D', 'E', 'C', '\0', '\0'};
+const uint32_t DECISION_VERSION = 1;
+
+struct DecisionRing {
+    atomic<bool> inUse{false};
+    atomic<uint64_t> next{0};  // events written so far
+    DecisionEvent events[DECISION_RING_EVENTS];
+};
+
+// Rings are never freed: a ring whose thread has exited is reused by the
+// next new thread, so the signal handler can walk them without locking
+struct DecisionRegistry {
+    DecisionRing* rings[MAX_DECISION_RINGS] = {};
+    atomic<int> count{0};
+    atomic<uint32_t> threads{0};
+    mutex lock;
+    char dumpPath[512] = "";
+};
+
+DecisionRegistry& decisionRegistry() {
+    static DecisionRegistry registry;
+    return registry;
+}
+
+DecisionRing* acquireDecisionRing() {
+    DecisionRegistry& registry = decisionRegistry();
+    lock_guard<mutex> guard(registry.lock);
+    DecisionRing* ring = nullptr;
+    int count = registry.count.load(memory_order_relaxed);
+    for (int i = 0; i < count && !ring; i++) {
+        if (!registry.rings[i]->inUse.load(memory_order_relaxed)) ring = registry.rings[i];
+    }
+    if (!ring) {
+        if (count == MAX_DECISION_RINGS) return nullptr;  // threads past the limit record nothing
+        ring = new DecisionRing;
+        registry.rings[count] = ring;
+        registry.count.store(count + 1, memory_order_release);
+    }
+    ring->inUse.store(true, memory_order_relaxed);
+    return ring;
+}
+
+struct DecisionRingHandle {
+    DecisionRing* ring = nullptr;
+    bool disabled = false;  // no ring was free; this thread's decisions are not recorded
+    ~DecisionRingHandle() {
+        if (ring) ring->inUse.store(false, memory_order_relaxed);
+    }
+};
+
+thread_local DecisionRingHandle decisionRing;
+
+// Takes a ring for this thread and opens it with a thread event, or
+// disables recording for the thread when every ring is taken
+DecisionRing* startDecisionRing() {
+    DecisionRing* ring = decisionRing.ring = acquireDecisionRing();
+    if (!ring) {
+        decisionRing.disabled = true;
+        return nullptr;
+    }
+    uint64_t n = ring->next.load(memory_order_relaxed);
+    ring->events[n & (DECISION_RING_EVENTS - 1)] = {EVENT_THREAD, 0, decisionRegistry().threads++, 0};
+    ring->next.store(n + 1, memory_order_release);
+    return ring;
+}
+
+inline DecisionRing* currentDecisionRing() {
+    if (decisionRing.ring || decisionRing.disabled) return decisionRing.ring;
+    return startDecisionRing();
+}
+
+inline void recordDecision(DecisionEventType type, uint32_t a = 0, uint64_t b = 0, uint16_t small = 0) {
+    DecisionRing* ring = currentDecisionRing();
+    if (!ring) return;
+    uint64_t n = ring->next.load(memory_order_relaxed);
+    ring->events[n & (DECISION_RING_EVENTS - 1)] = {type, small, a, b};
+    ring->next.store(n + 1, memory_order_release);
+}
+
+// Writes every ring to the dump path. Only uses open/write, so it can run
+// in a signal handler; rings still being written may tear their newest event.
+// File layout: magic, version, ring count, then per ring its event count
+// and DECISION_RING_EVENTS raw events.
+bool dumpDecisionTrace() {
+    DecisionRegistry& registry = decisionRegistry();
+    if (!registry.dumpPath[0]) return false;
+    int fd = ::open(registry.dumpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    uint32_t count = registry.count.load(memory_order_acquire);
+    bool ok = write(fd, DECISION_MAGIC, sizeof(DECISION_MAGIC)) == sizeof(DECISION_MAGIC) &&
+              write(fd, &DECISION_VERSION, sizeof(DECISION_VERSION)) == sizeof(DECISION_VERSION) &&
+              write(fd, &count, sizeof(count)) == sizeof(count);
+    for (uint32_t i = 0; ok && i < count; i++) {
+        const DecisionRing* ring = registry.rings[i];
+        uint64_t next = ring->next.load(memory_order_acquire);
+        ok = write(fd, &next, sizeof(next)) == sizeof(next) &&
+             write(fd, ring->events, sizeof(ring->events)) == (ssize_t)sizeof(ring->events);
+    }
+    close(fd);
+    return ok;
+}
+
+extern "C" void onDecisionDumpSignal(int signal) {
+    dumpDecisionTrace();
+    if (signal != SIGUSR1) raise(signal);  // the handler was reset: die as before, with the trace on disk
+}
+
+// Dumps go to `path`, by default iupac-decisions.PID.trace in the temp directory
+void installDecisionTrace(const string& path) {
+    DecisionRegistry& registry = decisionRegistry();
+    string target = path.empty() ? "/tmp/iupac-decisions." + to_string(getpid()) + ".trace" : path;
+    snprintf(registry.dumpPath, sizeof(registry.dumpPath), "%s", target.c_str());
+
+    struct sigaction action = {};
+    action.sa_handler = onDecisionDumpSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, nullptr);
+    action.sa_flags = SA_RESETHAND;
+    for (int fatal : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT}) sigaction(fatal, &action, nullptr);
+}
+
+// -------------------- Helper Functions --------------------
+
+// Version of the naming rules. Bump it with any change that alters a name or
+// property the engine produces; name caches written under another version
+// are discarded.
+const uint32_t NAMING_RULES_VERSION = 6;
+
+// Dense set of atom ids, one bit each. reset() keeps the allocation, so a
+// set reused from one molecule to the next stops allocating once it is big enough.
+class NodeSet {
+public:
+    void reset(int size) { words.assign((size + 63) / 64, 0); }
+    void insert(int id) { words[id >> 6] |= 1ULL << (id & 63); }
+    void erase(int id) { words[id >> 6] &= ~(1ULL << (id & 63)); }
+    bool contains(int id) const { return words[id >> 6] >> (id & 63) & 1; }
+
+private:
+    vector<uint64_t> words;
+};
+
+// Set of atom ids emptied in O(1): an id is in the set while its stamp
+// equals the current epoch, so a set filled once per chain needs no clearing
+class EpochSet {
+public:
+    void reset(int size) {
+        if ((int)stamps.size() < size) stamps.resize(size, 0);
+        clear();
+    }
+    void clear() {
+        if (++epoch == 0) {
+            fill(stamps.begin(), stamps.end(), 0);
+            epoch = 1;
+        }
+    }
+    void insert(int id) { stamps[id] = epoch; }
+    bool contains(int id) const { return stamps[id] == epoch; }
+
+private:
+    vector<uint32_t> stamps;
+    uint32_t epoch = 0;
+};
+
+// Graph represented as adjacency lists indexed by atom id (one per thread,
+// so molecules can be named in parallel; the lists keep their allocations
+// from one molecule to the next)
+thread_local vector<vector<int>> graph;
+
+// Carbons each node stands for: more than one for a (CH2)n run
+thread_local vector<int> runLength;
+
+int carbonsIn(int node) {
+    return node < (int)runLength.size() ? runLength[node] : 1;
+}
+
+// Locant of the first carbon of every node along a chain
+vector<int> chainLocants(const vector<int>& chain) {
+    vector<int> locants;
+    int next = 1;
+    for (int node : chain) {
+        locants.push_back(next);
+        next += carbonsIn(node);
+    }
+    return locants;
+}
+
+// Function to add an edge to the graph
+void addEdge(int u, int v) {
+    graph[u].push_back(v);
+    graph[v].push_back(u);
+}
+
+// Chain stem for a parent chain or alkyl substituent of the given length.
+// Past ten carbons the stem is built from the IUPAC numerical terms
+// (Undec, Icos, Henicos, Triacont, Hect, ...), up to 9999.
+string chainStem(int numCarbons) {
+    switch (numCarbons) {
+        case 1: return "Meth";
+        case 2: return "Eth";
+        case 3: return "Prop";
+        case 4: return "But";
+        case 5: return "Pent";
+        case 6: return "Hex";
+        case 7: return "Hept";
+        case 8: return "Oct";
+        case 9: return "Non";
+        case 10: return "Dec";
+    }
+    if (numCarbons < 11 || numCarbons > 9999) return "";
+
+    static const char* UNITS[] = {"", "hen", "do", "tri", "tetra", "penta", "hexa", "hepta", "octa", "nona"};
+    static const char* TENS[] = {"", "deca", "icosa", "triaconta", "tetraconta", "pentaconta",
+                                 "hexaconta", "heptaconta", "octaconta", "nonaconta"};
+    static const char* HUNDREDS[] = {"", "hecta", "dicta", "tricta", "tetracta", "pentacta",
+                                     "hexacta", "heptacta", "octacta", "nonacta"};
+    static const char* THOUSANDS[] = {"", "kilia", "dilia", "trilia", "tetralia", "pentalia",
+                                      "hexalia", "heptalia", "octalia", "nonalia"};
+    int units = numCarbons % 10, tens = numCarbons / 10 % 10;
+    string term = units == 1 && tens == 1 ? "un" : UNITS[units];  // 11 is undeca, not hendeca
+    string tensTerm = TENS[tens];
+    if (tens == 2 && !term.empty() && term.back() != 'n') tensTerm = "cosa";  // docosa, tricosa
+    term += tensTerm + HUNDREDS[numCarbons / 100 % 10] + THOUSANDS[numCarbons / 1000];
+    term.pop_back();  // the final 'a' is elided before -ane and -yl
+    term[0] = toupper(term[0]);
+    return term;
+}
+
+string formatBranchName(int numCarbons, int halogenType) {
+    // For halogens, return just the halogen name
+    if (halogenType > 0) {
+        switch (halogenType) {
+            case 1: return "chloro";
+            case 2: return "bromo";
+            case 3: return "fluoro";
+            case 4: return "iodo";
+            default: return "halo";
+        }
+    }
+
+    // For straight alkyl branches
+    string stem = chainStem(numCarbons);
+    if (stem.empty()) return "";
+    stem[0] = tolower(stem[0]);
+    return stem + "yl";
+}
+
+
+/// Helper function to combine branches with identical names and add prefixes for duplicates.
+/// Takes (name, locants) groups; nested substituent names write their locants bare (1,1-dimethylethyl),
+/// and one-carbon substituents write none (dichloromethyl).
+vector<string> combineBranches(const vector<pair<string, vector<int>>>& groups, bool nested, bool withLocants = true) {
+    vector<string> combinedBranches;
+    for (const auto& group : groups) {
+        const string& branchName = group.first;
+        const vector<int>& locants = group.second;
+
+        if (!withLocants) {  // a one-carbon substituent carries at most three
+            combinedBranches.push_back(string(locants.size() == 3 ? "tri" : locants.size() == 2 ? "di" : "") + branchName);
+            continue;
+        }
+
+        // Combine locants if there are multiple, otherwise keep single locant
+        if (locants.size() > 1) {
+            string prefix = ""; // Prefix for naming based on the count
+            if (locants.size() == 2) {
+                prefix = "di";
+            } else if (locants.size() == 3) {
+                prefix = "tri";
+            } else if (locants.size() > 3) {
+                prefix = to_string(locants.size()) + "-";
+            }
+
+            // A multiplied halomethyl keeps its parentheses: di(chloromethyl), not dichloromethyl
+            bool haloMethyl = branchName.size() > 6 && branchName[0] != '(' &&
+                              branchName.compare(branchName.size() - 6, 6, "methyl") == 0;
+
+            string combinedLocants = to_string(locants[0]);
+            for (size_t j = 1; j < locants.size(); j++) {
+                combinedLocants += "," + to_string(locants[j]);
+            }
+            if (!nested) combinedLocants = "(" + combinedLocants + ")";
+            combinedBranches.push_back(combinedLocants + "-" + prefix + (haloMethyl ? "(" + branchName + ")" : branchName));
+        } else {
+            combinedBranches.push_back(to_string(locants[0]) + "-" + branchName);
+        }
+    }
+
+    return combinedBranches;
+}
+
+
+
+// Groups "locant-name" substituent entries by their exact name and joins them
+// into a name prefix, in order of each group's lowest locant
+string joinSubstituentPrefix(const vector<string>& branches, bool nested = false, bool withLocants = true) {
+    vector<pair<string, vector<int>>> groups;
+    unordered_map<string, size_t> groupOf;
+    for (const string& branch : branches) {
+        size_t dashPos = branch.find('-');
+        string branchName = branch.substr(dashPos + 1);
+        auto group = groupOf.emplace(branchName, groups.size());
+        if (group.second) groups.push_back({branchName, {}});
+        groups[group.first->second].second.push_back(atoi(branch.c_str()));
+    }
+    for (auto& group : groups) sort(group.second.begin(), group.second.end());
+    sort(groups.begin(), groups.end(), [](const pair<string, vector<int>>& a, const pair<string, vector<int>>& b) {
+        return a.second[0] != b.second[0] ? a.second[0] < b.second[0] : a.first < b.first;
+    });
+
+    string prefix;
+    for (const string& branch : combineBranches(groups, nested, withLocants)) {
+        if (!prefix.empty() && withLocants) prefix += "-";
+        prefix += branch;
+    }
+    return prefix;
+}
+
+// An alkyl substituent of `numCarbons` carbons carrying `entries`
+// ("locant-name"), written as it is cited in a larger name. A one-carbon
+// substituent takes no locants (chloromethyl); one with locants or with
+// several prefixes goes in parentheses ((dichloromethyl), (1-methylethyl)).
+// Empty when the chain is too long for a stem.
+string substituentName(const vector<string>& entries, int numCarbons) {
+    string stem = formatBranchName(numCarbons, 0);
+    if (stem.empty() || entries.empty()) return stem;
+    string name = joinSubstituentPrefix(entries, true, numCarbons > 1) + stem;
+    return entries.size() == 1 && numCarbons == 1 ? name : "(" + name + ")";
+}
+
+string generateIUPACName(const vector<int>& longestChain, unordered_map<int, vector<string>>& branchInfo, int counter) {
+    vector<int> locants = chainLocants(longestChain);
+    int numCarbons = longestChain.empty() ? 0 : locants.back() + carbonsIn(longestChain.back()) - 1;
+    string chainName = chainStem(numCarbons);
+    if (chainName.empty()) return "";  // no stem past 9999 carbons, so no name
+
+    if(counter==0)
+    {
+        chainName = chainName + "ane";
+    }
+    else if (counter==1)
+    {
+        chainName = chainName + "an";
+    }
+    else if(counter==2)
+    {
+        chainName = chainName + "yl";
+    }
+    
+
+    // Generate branch names with locants
+    vector<string> branches;
+    for (size_t i = 0; i < longestChain.size(); i++) {
+        int atom = longestChain[i];
+        if (branchInfo.find(atom) != branchInfo.end()) {
+            // Process ALL branches for this atom
+            for (const string& branchName : branchInfo[atom]) {
+                if (branchName.empty()) return "";  // a substituent too long to name
+                int locant = locants[i];  // 1-based locant
+                branches.push_back(to_string(locant) + "-" + branchName);
+            }
+        }
+    }
+
+    // Combine branch information with the main chain name
+    return joinSubstituentPrefix(branches) + chainName;
+}
+
+
+// 64-bit finalizer (splitmix64) used to build canonical subtree hashes
+uint64_t mixHash(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// FNV-1a, used wherever a hash ends up on disk and must not change between builds
+uint64_t stableHash(string_view text) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char ch : text) {
+        hash ^= ch;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Marks the start of a formula: its hash, length and first 8 bytes
+void recordMolecule(string_view formula) {
+    uint64_t prefix = 0;
+    memcpy(&prefix, formula.data(), min<size_t>(formula.size(), sizeof(prefix)));
+    recordDecision(EVENT_MOLECULE, (uint32_t)stableHash(formula), prefix, (uint16_t)min<size_t>(formula.size(), UINT16_MAX));
+}
+
+// Names the substituents hanging off a main chain. Every branch is analysed
+// once as a tree rooted at its attachment atom (depth, substituent count and
+// a canonical subtree id per node), then named recursively: the longest chain
+// from the attachment point becomes the substituent stem and everything off
+// it becomes its own sub-substituent. Equal ids mean identical subtrees, so
+// names are memoized by id and repeated subtrees are only named once.
+template <class Trace>
+class SubstituentNamer {
+public:
+    struct BranchNode {
+        int depth = 0;           // carbons on the longest chain starting here
+        int substituents = 0;    // substituents along that chain
+        int next = -1;           // next atom of that chain, -1 at its end
+        int subtree = -1;        // canonical id of the subtree rooted here
+        vector<int> children;
+    };
+
+    const EpochSet& mainChainNodes;
+    const NodeSet& ignoredNodes;
+    const MolecularGraph& molecule;
+    const vector<vector<int>>& adjacency;
+    WorkBudget& budget;
+
+    vector<BranchNode> nodes;  // by atom id
+    unordered_map<int, string> names;  // canonical subtree id -> substituent name
+
+    SubstituentNamer(const EpochSet& mainChainNodes, const NodeSet& ignoredNodes, const MolecularGraph& molecule,
+                     const vector<vector<int>>& adjacency, WorkBudget& budget)
+        : mainChainNodes(mainChainNodes), ignoredNodes(ignoredNodes), molecule(molecule), adjacency(adjacency),
+          budget(budget), nodes(molecule.counter) {}
+
+    // Bottom-up pass over the branch rooted at `root`, entered from
+    // `rootParent`. Iterative with an explicit post-order stack, so deep
+    // branches cannot overflow the stack.
+    const BranchNode& analyze(int root, int rootParent) {
+        stack.assign(1, {root, rootParent});
+        order.clear();
+        while (!stack.empty()) {
+            auto [node, parent] = stack.back();
+            stack.pop_back();
+            if (!budget.spend()) return nodes[root] = BranchNode();
+
+            // Debugging print to see the label being processed
+            if constexpr (Trace::enabled) cout << "Processing label: " << molecule.label(node) << node << endl;
+            order.push_back({node, parent});
+            const vector<int>& neighbors = adjacency[node];
+            for (auto it = neighbors.rbegin(); it != neighbors.rend(); ++it) {  // visited in adjacency order
+                if (*it == parent || ignoredNodes.contains(*it) || mainChainNodes.contains(*it)) continue;
+                stack.push_back({*it, node});
+            }
+        }
+        // Children come after their parent in `order`, so walking it backwards combines them first
+        for (size_t i = order.size(); i-- > 0;) combine(order[i].first, order[i].second);
+        return nodes[root];
+    }
+
+    // Name of the substituent rooted at `node` as it is cited in a larger
+    // name (see substituentName); analyze() must have visited it
+    string name(int node) {
+        const BranchNode& root = nodes[node];
+        auto memo = names.find(root.subtree);
+        if (memo != names.end()) return memo->second;
+
+        vector<string> entries;
+        int locant = 1;
+        for (int atom = node; atom != -1; locant += molecule.run(atom), atom = nodes[atom].next) {
+            if (!budget.spend()) return "";
+            for (int type = 1; type <= 4; type++) {
+                for (int n = 0; n < molecule.halogenCount(atom, type); n++) {
+                    entries.push_back(to_string(locant) + "-" + formatBranchName(0, type));
+                }
+            }
+            for (int child : nodes[atom].children) {
+                if (child == nodes[atom].next) continue;
+                string childName = name(child);
+                if (childName.empty()) return names[root.subtree] = "";
+                entries.push_back(to_string(locant) + "-" + childName);
+            }
+        }
+
+        // Substituents too long for a stem have no name, and neither does anything citing them
+        string result = substituentName(entries, root.depth);
+        if constexpr (Trace::enabled) cout << "Substituent at " << molecule.label(node) << node << ": " << result << endl;
+        return names[root.subtree] = result;
+    }
+
+private:
+    struct SubtreeKeyHash {
+        size_t operator()(const vector<uint64_t>& key) const {
+            uint64_t hash = key.size();
+            for (uint64_t part : key) hash = mixHash(hash + part);
+            return hash;
+        }
+    };
+
+    vector<pair<int, int>> stack, order;  // (atom, parent) pairs of the branch being analysed
+    // (kind, run, halogens, sorted child ids) -> canonical id; keys are compared
+    // in full, so different subtrees never share an id
+    unordered_map<vector<uint64_t>, int, SubtreeKeyHash> subtrees;
+    vector<uint64_t> key;
+    vector<long long> locantsA, locantsB;
+
+    // Fills nodes[node] from its children, which are already analysed
+    void combine(int node, int parent) {
+        BranchNode info;
+        key.assign({(uint64_t)molecule.kinds[node], (uint64_t)molecule.run(node), molecule.halogenKey(node)});
+        for (int neighbor : adjacency[node]) {
+            if (neighbor == parent || ignoredNodes.contains(neighbor) || mainChainNodes.contains(neighbor)) continue;
+            info.children.push_back(neighbor);
+            key.push_back(nodes[neighbor].subtree);
+            if (info.next == -1 || preferredChain(neighbor, info.next)) info.next = neighbor;
+        }
+        sort(key.begin() + 3, key.end());
+        info.subtree = subtrees.emplace(key, subtrees.size()).first->second;
+
+        info.depth = molecule.run(node);
+        info.substituents = molecule.halogenCount(node) + (int)info.children.size();
+        if (info.next != -1) {
+            const BranchNode& best = nodes[info.next];
+            info.depth += best.depth;
+            info.substituents += best.substituents - 1;
+        }
+        nodes[node] = info;
+    }
+
+    // Whether the substituent chain should continue into `a` rather than
+    // `b`: the longer chain, then the one with more substituents, then
+    // lower locants for them at the first point of difference. Past that the
+    // chain continues into the branch whose name comes last alphabetically,
+    // so the other one, cited at the lower locant, is the first in
+    // alphabetical order. Identical subtrees give the same name either way.
+    bool preferredChain(int a, int b) {
+        const BranchNode& x = nodes[a];
+        const BranchNode& y = nodes[b];
+        if (x.depth != y.depth) return x.depth > y.depth;
+        if (x.substituents != y.substituents) return x.substituents > y.substituents;
+        if (x.subtree == y.subtree) return false;
+        substituentLocants(a, locantsA);
+        substituentLocants(b, locantsB);
+        if (locantsA != locantsB) return locantsA < locantsB;
+        return letters(name(a)) > letters(name(b));
+    }
+
+    static string letters(const string& name) {
+        string result;
+        for (char ch : name) {
+            if (isalpha(ch)) result += ch;
+        }
+        return result;
+    }
+
+    // Locants of the substituents along the chain followed from `node`,
+    // counted from `node` as 1
+    void substituentLocants(int node, vector<long long>& locants) {
+        locants.clear();
+        long long locant = 1;
+        for (int atom = node; atom != -1 && budget.spend(); locant += molecule.run(atom), atom = nodes[atom].next) {
+            int count = molecule.halogenCount(atom) + (int)nodes[atom].children.size() - (nodes[atom].next != -1);
+            locants.insert(locants.end(), count, locant);
+        }
+    }
+};
+
+// Picks the parent chain among all longest carbon chains (only those
+// starting at a COOH carbon when there is one): most substituents, then
+// lowest locants at the first point of difference, then the lowest locant
+// for the substituent cited first in alphabetical order.
+//
+// Chains are never listed one by one. A rerooting pass over the carbon tree
+// gives the best (length, substituents) of the chain leaving any atom
+// through any bond. The numbering walk then grows all optimal chains
+// together, one locant at a time: a partial chain survives only while it
+// can still be completed to an optimal chain and its substituent counts are
+// the highest so far at the first point of difference, and partial chains
+// that reach the same bond are merged. Only chains still tied at the end are
+// named to apply the alphabetical rule, in parallel for big molecules.
+class ParentChainSelector {
+public:
+    typedef pair<long long, long long> ChainKey;  // (carbons, substituents - 2)
+
+    const MolecularGraph& molecule;
+    const vector<vector<int>>& adjacency;
+    const NodeSet& ignoredNodes;
+    WorkBudget& budget;
+
+    ParentChainSelector(const MolecularGraph& molecule, const vector<vector<int>>& adjacency,
+                        const NodeSet& ignoredNodes, WorkBudget& budget)
+        : molecule(molecule), adjacency(adjacency), ignoredNodes(ignoredNodes), budget(budget) {}
+
+    // Atom ids of the parent chain in locant order. `starts` are the atoms
+    // allowed at locant 1 (all carbons when empty).
+    vector<int> select(const vector<int>& carbons, const vector<int>& starts) {
+        index(carbons);
+        reroot();
+
+        ChainKey target = {-1, 0};
+        vector<int> startAtoms;
+        for (int id : starts.empty() ? carbons : starts) startAtoms.push_back(local[id]);
+        for (int x : startAtoms) target = max(target, bestFrom(x));
+        recordDecision(EVENT_CHAIN_TARGET, target.first, target.second + 2);
+
+        vector<vector<int>> tied = walk(startAtoms, target);
+        if (budget.exceeded || tied.empty()) return {};
+        if (tied.size() == 1) return tied[0];
+        recordDecision(EVENT_TIED_CHAINS, tied.size());
+        int winner = alphabeticalWinner(tied);
+        recordDecision(EVENT_ALPHABETICAL, winner);
+        return tied[winner];
+    }
+
+private:
+    // Tied chains named for the alphabetical rule; more are equivalent in practice
+    static const int MAX_TIED_CHAINS = 32;
+    // Carbons from which tied chains are named on several threads
+    static const int PARALLEL_CHAIN_ATOMS = 4096;
+
+    struct PartialChain {
+        int last, prev;        // last atom and the one before it (-1 for none)
+        ChainKey sum;          // key of the atoms so far
+        vector<int> parents;   // partial chains this one extends, merged
+    };
+
+    vector<int> ids;           // local index -> atom id
+    vector<int> local;         // atom id -> local index
+    vector<vector<int>> bonds; // carbon neighbours, local indices
+    vector<ChainKey> base;     // (carbons, substituent count - 2) of each atom
+    vector<int> parent;
+    vector<ChainKey> down, up; // best chain into the subtree / out through the parent
+
+    void index(const vector<int>& carbons) {
+        local.assign(molecule.counter, -1);
+        for (int id : carbons) {
+            local[id] = ids.size();
+            ids.push_back(id);
+        }
+        bonds.resize(ids.size());
+        base.resize(ids.size());
+        for (size_t i = 0; i < ids.size(); i++) {
+            for (int neighbor : adjacency[ids[i]]) {
+                if (local[neighbor] >= 0) bonds[i].push_back(local[neighbor]);
+            }
+            base[i] = {molecule.run(ids[i]), (long long)bonds[i].size() + molecule.halogenCount(ids[i]) - 2};
+        }
+    }
+
+    static ChainKey add(const ChainKey& a, const ChainKey& b) { return {a.first + b.first, a.second + b.second}; }
+
+    // Iterative, so long chains cannot overflow the stack
+    void reroot() {
+        int n = ids.size();
+        parent.assign(n, -2);
+        down.assign(n, {0, 0});
+        up.assign(n, {0, 0});
+        vector<int> order;
+        for (int root = 0; root < n; root++) {
+            if (parent[root] != -2) continue;
+            parent[root] = -1;
+            vector<int> stack = {root};
+            while (!stack.empty()) {
+                int v = stack.back();
+                stack.pop_back();
+                order.push_back(v);
+                for (int c : bonds[v]) {
+                    if (parent[c] == -2) {
+                        parent[c] = v;
+                        stack.push_back(c);
+                    }
+                }
+            }
+        }
+        for (int k = n - 1; k >= 0; k--) {
+            int v = order[k];
+            ChainKey best = {0, 0};
+            for (int c : bonds[v]) {
+                if (c != parent[v]) best = max(best, down[c]);
+            }
+            down[v] = add(base[v], best);
+        }
+        for (int v : order) {
+            // The two best chains into v's subtree, so each child can take the best other one
+            ChainKey first = parent[v] >= 0 ? up[v] : ChainKey{0, 0}, second = {0, 0};
+            int firstChild = -1;
+            for (int c : bonds[v]) {
+                if (c == parent[v]) continue;
+                if (down[c] > first) {
+                    second = first;
+                    first = down[c];
+                    firstChild = c;
+                } else if (down[c] > second) {
+                    second = down[c];
+                }
+            }
+            for (int c : bonds[v]) {
+                if (c != parent[v]) up[c] = add(base[v], c == firstChild ? second : first);
+            }
+        }
+    }
+
+    // Best chain starting at `v` and continuing away from `from`
+    ChainKey leaving(int from, int v) const { return parent[v] == from ? down[v] : up[from]; }
+
+    ChainKey bestFrom(int x) const {
+        ChainKey best = {0, 0};
+        for (int c : bonds[x]) best = max(best, leaving(x, c));
+        return add(base[x], best);
+    }
+
+    // Substituents on `v` when it sits on a chain of `length` carbons, ending it or not
+    long long substituentsAt(int v, bool end, long long length) const {
+        if (base[v].first == length) return base[v].second + 2;
+        return base[v].second + (end ? 1 : 0);
+    }
+
+    vector<vector<int>> walk(const vector<int>& startAtoms, const ChainKey& target) {
+        vector<PartialChain> chains;
+        map<long long, vector<int>> pending;  // next locant -> partial chains
+
+        // Locant 1: the best-ranked start atoms
+        long long best = -1;
+        for (int x : startAtoms) {
+            if (bestFrom(x) == target) best = max(best, substituentsAt(x, true, target.first));
+        }
+        NodeSet started;  // local indices already starting a chain
+        started.reset(ids.size());
+        for (int x : startAtoms) {
+            if (bestFrom(x) != target || substituentsAt(x, true, target.first) != best || started.contains(x)) continue;
+            started.insert(x);
+            chains.push_back({x, -1, base[x], {}});
+            pending[1 + base[x].first].push_back(chains.size() - 1);
+        }
+        recordDecision(EVENT_CHAIN_STARTS, chains.size(), best);
+
+        while (!pending.empty() && pending.begin()->first <= target.first) {
+            long long locant = pending.begin()->first;
+            vector<int> extending = pending.begin()->second;
+            pending.erase(pending.begin());
+
+            // Chains still inside a (CH2)n run have nothing at this locant
+            long long highest = pending.empty() ? -1 : 0;
+            vector<pair<int, int>> next;  // (partial chain, next atom)
+            vector<long long> counts;
+            for (int i : extending) {
+                const PartialChain& chain = chains[i];
+                for (int v : bonds[chain.last]) {
+                    if (!budget.spend()) return {};
+                    if (v == chain.prev || add(chain.sum, leaving(chain.last, v)) != target) continue;
+                    long long count = substituentsAt(v, chain.sum.first + base[v].first == target.first, target.first);
+                    if (count < highest) continue;
+                    highest = count;
+                    next.emplace_back(i, v);
+                    counts.push_back(count);
+                }
+            }
+            if (highest > 0) pending.clear();  // every other chain has fewer at the first difference
+            if (next.size() > 1) {
+                // Only locants where more than one chain was in play are recorded
+                size_t kept = count(counts.begin(), counts.end(), highest);
+                recordDecision(EVENT_LOCANT, locant, kept, (uint16_t)min<long long>(max(highest, 0LL), UINT16_MAX));
+            }
+
+            unordered_map<long long, int> merged;  // (prev, last) -> partial chain
+            for (size_t k = 0; k < next.size(); k++) {
+                if (counts[k] != highest) continue;
+                int i = next[k].first, v = next[k].second, from = chains[i].last;
+                long long bond = (long long)from * (long long)ids.size() + v;
+                auto it = merged.find(bond);
+                if (it != merged.end()) {
+                    chains[it->second].parents.push_back(i);
+                    continue;
+                }
+                chains.push_back({v, from, add(chains[i].sum, base[v]), {i}});
+                merged[bond] = chains.size() - 1;
+                pending[locant + base[v].first].push_back(chains.size() - 1);
+            }
+        }
+
+        // Every chain left is complete and tied; list up to MAX_TIED_CHAINS of
+        // them by walking the merged parents back to locant 1
+        vector<vector<int>> tied;
+        vector<int> path;
+        vector<pair<int, size_t>> stack;  // (partial chain, next parent to visit)
+        auto enter = [&](int i) {
+            stack.emplace_back(i, 0);
+            path.push_back(ids[chains[i].last]);
+            if (chains[i].parents.empty()) tied.emplace_back(path.rbegin(), path.rend());
+        };
+        for (const auto& entry : pending) {
+            for (int done : entry.second) {
+                enter(done);
+                while (!stack.empty() && (int)tied.size() < MAX_TIED_CHAINS) {
+                    int i = stack.back().first;
+                    size_t next = stack.back().second++;
+                    if (next < chains[i].parents.size()) {
+                        enter(chains[i].parents[next]);
+                    } else {
+                        stack.pop_back();
+                        path.pop_back();
+                    }
+                }
+                stack.clear();
+                path.clear();
+            }
+        }
+        return tied;
+    }
+
+    // Locants of the substituents in alphabetical order of their names. A
+    // branch's name only depends on the bond it hangs from (the carbon
+    // skeleton is a tree), so names are cached per bond across tied chains.
+    vector<int> alphabeticalLocants(const vector<int>& chain, SubstituentNamer<NoTrace>& namer, EpochSet& onChain,
+                                    unordered_map<long long, string>& branchNames) const {
+        onChain.clear();
+        for (int atom : chain) onChain.insert(atom);
+        vector<pair<string, int>> cited;
+        int locant = 1;
+        for (int atom : chain) {
+            for (int type = 1; type <= 4; type++) {
+                for (int n = 0; n < molecule.halogenCount(atom, type); n++) cited.emplace_back(formatBranchName(0, type), locant);
+            }
+            for (int neighbor : adjacency[atom]) {
+                if (ignoredNodes.contains(neighbor) || onChain.contains(neighbor)) continue;
+                long long bond = (long long)atom * molecule.counter + neighbor;
+                auto cached = branchNames.find(bond);
+                if (cached == branchNames.end()) {
+                    namer.analyze(neighbor, atom);
+                    string letters;
+                    for (char ch : namer.name(neighbor)) {
+                        if (isalpha(ch)) letters += ch;
+                    }
+                    cached = branchNames.emplace(bond, letters).first;
+                }
+                cited.emplace_back(cached->second, locant);
+            }
+            locant += molecule.run(atom);
+        }
+        sort(cited.begin(), cited.end());
+        vector<int> locants;
+        for (const auto& entry : cited) locants.push_back(entry.second);
+        return locants;
+    }
+
+    int alphabeticalWinner(const vector<vector<int>>& tied) {
+        vector<vector<int>> locants(tied.size());
+        size_t threads = ids.size() >= PARALLEL_CHAIN_ATOMS ? min<size_t>(tied.size(), thread::hardware_concurrency()) : 1;
+        vector<WorkBudget> work(max<size_t>(threads, 1), budget);
+        auto score = [&](size_t first, size_t stride) {
+            // Every thread has its own namer, cache and budget; the namer
+            // needs no main chain, as no branch of a tree leads back to it
+            EpochSet noChain, onChain;
+            noChain.reset(molecule.counter);
+            onChain.reset(molecule.counter);
+            SubstituentNamer<NoTrace> namer(noChain, ignoredNodes, molecule, adjacency, work[first]);
+            unordered_map<long long, string> branchNames;
+            for (size_t k = first; k < tied.size(); k += stride) {
+                locants[k] = alphabeticalLocants(tied[k], namer, onChain, branchNames);
+            }
+        };
+        if (threads > 1) {
+            vector<thread> workers;
+            for (size_t t = 0; t < threads; t++) workers.emplace_back(score, t, threads);
+            for (thread& worker : workers) worker.join();
+        } else {
+            score(0, 1);
+        }
+
+        long long steps = 0;
+        for (const WorkBudget& part : work) {
+            steps += part.steps - budget.steps;
+            if (part.exceeded) budget.exceeded = true;
+        }
+        budget.spend(steps);
+
+        int winner = 0;
+        for (size_t k = 1; k < tied.size(); k++) {
+            if (locants[k] < locants[winner]) winner = k;
+        }
+        return winner;
+    }
+};
+
+// Main chain and substituents behind a name, kept for the compiled-molecule format
+struct ChainResult {
+    vector<int> chain;                        // parsed carbon ids, locant order
+    vector<pair<int, string>> substituents;   // (locant, prefix)
+};
+
+// Modify the function signature to return a string
+template <class Trace>
+string processMolecularGraph(MolecularGraph& graph1, int hint, WorkBudget& budget, ChainResult* result = nullptr) {
+    // The per-thread adjacency lists, run lengths and node sets are refilled for every molecule
+    graph.resize(graph1.counter);
+    for (vector<int>& neighbors : graph) neighbors.clear();
+    runLength.assign(graph1.counter, 1);
+    static thread_local NodeSet ignoredNodes;
+    static thread_local EpochSet mainChainNodes;
+    ignoredNodes.reset(graph1.counter);
+    mainChainNodes.reset(graph1.counter);
+    // A bad repeat count has no name. Written-out repeat units are paid for
+    // up front; a graph too big to build was not built
+    if (graph1.malformed) return "";
+    if (graph1.oversized || !budget.spend(graph1.repeatSteps)) {
+        budget.exceeded = true;
+        recordDecision(EVENT_BUDGET_EXCEEDED, 0, budget.steps);
+        return "";
+    }
+    graph1.printAtomsInfo<Trace>();
+    recordDecision(EVENT_GRAPH, graph1.counter - 1, graph1.edges.size());
+    bool cycle = graph1.hasCyclicEdge<Trace>();
+    if(cycle) {
+        recordDecision(EVENT_RING_CLOSURE, graph1.edges.back().first, graph1.edges.back().second);
+        return "";
+    }
+    graph1.printEdges<Trace>();
+
+    int counter = 0;
+
+    vector<int> coohNodes;  // COOH node IDs, ascending
+    unordered_map<int, vector<string>> branchInfo;
+
+    vector<int> carbonNodes;
+
+    // The working graph uses the parsed atom ids; atoms outside every bond take no part
+    for (const auto& edge : graph1.edges) addEdge(edge.first, edge.second);
+    for (int id = 1; id < graph1.counter; id++) {
+        if (graph[id].empty()) continue;
+        if (graph1.kinds[id] == KIND_COOH) coohNodes.push_back(id);
+
+        // Ignore non-carbon nodes for main chain detection
+        if (graph1.isCarbon(id)) carbonNodes.push_back(id);
+        else ignoredNodes.insert(id);
+
+        if (graph1.run(id) > 1) runLength[id] = graph1.run(id);
+    }
+
+    if (carbonNodes.empty()) {
+        if constexpr (Trace::enabled) cout << "No carbon atoms found in the input.\n";
+        return "";
+    }
+
+    // Step 1: Pick and number the parent chain; with a COOH group, locant 1 is a COOH carbon
+    recordDecision(EVENT_CARBONS, carbonNodes.size(), 0, min<size_t>(coohNodes.size(), UINT16_MAX));
+    if (!coohNodes.empty()) counter = 1;
+    ParentChainSelector selector(graph1, graph, ignoredNodes, budget);
+    vector<int> longestChain = selector.select(carbonNodes, coohNodes);
+    if (budget.exceeded) {
+        recordDecision(EVENT_BUDGET_EXCEEDED, 0, budget.steps);
+        return "";
+    }
+    if (!longestChain.empty()) {
+        recordDecision(EVENT_CHAIN, longestChain.size(), (uint64_t)longestChain.front() << 32 | (uint32_t)longestChain.back());
+    }
+
+    for (int atom : longestChain) mainChainNodes.insert(atom);
+    SubstituentNamer<Trace> namer(mainChainNodes, ignoredNodes, graph1, graph, budget);
+
+    // Step 2: Store branch information AND halogen information on the original chain
+    for (int atom : longestChain) {
+        if (budget.exceeded) break;
+
+        // First, check for halogens directly on this carbon
+        for (int type = 1; type <= 4; type++) {
+            for (int n = 0; n < graph1.halogenCount(atom, type); n++) {
+                branchInfo[atom].push_back(formatBranchName(0, type));
+            }
+        }
+        if (graph1.halogenCount(atom) > 0) {
+            recordDecision(EVENT_HALOGEN, atom, graph1.halogenCount(atom), graph1.halogenType(atom));
+        }
+        
+        // Then name the carbon branches
+        for (int neighbor : graph[atom]) {
+            if (!ignoredNodes.contains(neighbor) && !mainChainNodes.contains(neighbor)) {
+                
+                // Neighbor is a branch starting point
+                const auto& branch = namer.analyze(neighbor, atom);
+                recordDecision(EVENT_BRANCH, neighbor, (uint64_t)branch.depth << 32 | (uint32_t)branch.substituents,
+                               graph1.halogenType(neighbor));
+
+                // Add ALL branches (no more overwriting)
+                branchInfo[atom].push_back(namer.name(neighbor));
+            }
+        }
+    }
+    if (budget.exceeded) {
+        recordDecision(EVENT_BUDGET_EXCEEDED, 0, budget.steps);
+        return "";
+    }
+
+    // Step 3: The selector has already numbered the chain from its better end
+    const vector<int>& optimalChain = longestChain;
+
+    if (hint == 1) counter = 2;
+
+    // Print the longest carbon chain using node labels
+    if constexpr (Trace::enabled) {
+        cout << "Longest carbon chain: ";
+        for (int node : optimalChain) {
+            cout << graph1.label(node) << node << " ";
+        }
+        cout << endl;
+    }
+
+    // Step 4: Generate IUPAC name (append -oic acid if needed)
+    string iupacName = generateIUPACName(optimalChain, branchInfo, counter);
+    if (!iupacName.empty() && !coohNodes.empty()) {
+        iupacName += "oic acid";
+    }
+
+    recordDecision(EVENT_NAME, iupacName.size(), stableHash(iupacName));
+    if constexpr (Trace::enabled) cout << "IUPAC Name: " << iupacName << endl;
+
+    if (result) {
+        vector<int> locants = chainLocants(optimalChain);
+        for (size_t i = 0; i < optimalChain.size(); i++) {
+            int node = optimalChain[i];
+            result->chain.push_back(node);
+            for (const string& prefix : branchInfo[node]) result->substituents.emplace_back(locants[i], prefix);
+        }
+    }
+
+    return iupacName; // Return the IUPAC name for use in ethers
+}
+
+// Helper function to generate IUPAC name for a single molecular graph
+template <class Trace>
+string generateIUPACNameForGraph(MolecularGraph& graph, WorkBudget& budget) {
+    return processMolecularGraph<Trace>(graph, 1, budget); // This will print atom info and IUPAC name internally
+    
+}
+
+// Splits an ether written as R-O-R' into its two alkyl formulas
+bool splitEther(const string& formula, string& f1, string& f2) {
+    size_t pos = formula.find('-');
+    if(pos != string::npos && pos + 2 < formula.length() && formula[pos + 1] == 'O' && formula[pos + 2] == '-') {
+        f1 = formula.substr(0, pos);
+        f2 = formula.substr(pos + 3);
+        return true;
+    }
+    return false;
+}
+
+// Names a condensed formula, including ethers written as R-O-R'
+// Molecular properties come out of the same parse and are stored in `properties` if given;
+// `result` receives the main chain and substituents (left empty for ethers).
+template <class Trace>
+string nameFormula(const string& formula, WorkBudget& budget, MolecularProperties* properties = nullptr,
+                   ChainResult* result = nullptr) {
+    recordMolecule(formula);
+    string f1, f2;
+    if (splitEther(formula, f1, f2)) {
+        if constexpr (Trace::enabled) cout<<f1<<" "<<f2<<endl;
+
+        MolecularGraph g1, g2;
+        g1.parseMolecularFormula(f1, &budget);
+        g2.parseMolecularFormula(f2, &budget);
+        if (properties) {
+            *properties = g1.properties;
+            properties->merge(g2.properties);
+            properties->add(ELEMENT_O);
+        }
+        
+        string name1 = generateIUPACNameForGraph<Trace>(g1, budget);
+        string name2 = generateIUPACNameForGraph<Trace>(g2, budget);
+        if (name1.empty() || name2.empty()) return "";  // an unnamed half leaves the ether unnamed
+
+        // Ensure the smaller group name comes first
+        if (name1 > name2) {
+            swap(name1, name2);
+        }
+        return name1 + " " + name2 + " ether";
+    }
+
+    MolecularGraph graph;
+    graph.parseMolecularFormula(formula, &budget);
+    if (properties) *properties = graph.properties;
+    return processMolecularGraph<Trace>(graph, 0, budget, result);
+}
+
+// -------------------- Name-to-Structure Parser --------------------
+
+// Longest chain the reverse parser knows a stem for (chainStem goes on to 9999)
+const int MAX_STEM_LENGTH = 99;
+
+// Trie over the words the forward direction emits: chain stems, suffixes,
+// multiplying prefixes and halogen substituents. Built once from chainStem()
+// and formatBranchName() so both directions always agree, then compiled into
+// a flat transition table indexed by lowercase letter.
+class NameTrie {
+public:
+    enum TokenKind { NONE, STEM, HALOGEN, MULTIPLIER, SUFFIX_ANE, SUFFIX_AN, SUFFIX_YL, SUFFIX_OIC_ACID };
+
+    struct Token {
+        TokenKind kind = NONE;
+        int value = 0;   // stem length, halogen type or multiplier count
+        int length = 0;  // characters consumed
+    };
+
+    NameTrie() {
+        nodes.emplace_back();
+        for (int n = 1; n <= MAX_STEM_LENGTH; n++) {
+            string stem = chainStem(n);
+            if (!stem.empty()) addWord(stem, STEM, n);
+        }
+        for (int halogenType = 1; halogenType <= 4; halogenType++) {
+            addWord(formatBranchName(0, halogenType), HALOGEN, halogenType);
+        }
+        addWord("di", MULTIPLIER, 2);
+        addWord("tri", MULTIPLIER, 3);
+        addWord("ane", SUFFIX_ANE, 0);
+        addWord("an", SUFFIX_AN, 0);
+        addWord("yl", SUFFIX_YL, 0);
+        addWord("oic acid", SUFFIX_OIC_ACID, 0);
+    }
+
+    // Longest word starting at text[pos]; case-insensitive so parent stems ("Hex") match too
+    Token match(const string& text, size_t pos) const {
+        Token best;
+        int node = 0;
+        for (size_t i = pos; i < text.size(); i++) {
+            int c = slot(text[i]);
+            if (c < 0 || nodes[node].next[c] == 0) break;
+            node = nodes[node].next[c];
+            if (nodes[node].kind != NONE) {
+                best.kind = nodes[node].kind;
+                best.value = nodes[node].value;
+                best.length = i - pos + 1;
+            }
+        }
+        return best;
+    }
+
+private:
+    static const int ALPHABET = 27;  // a-z and the space in "oic acid"
+
+    struct Node {
+        int next[ALPHABET] = {};
+        TokenKind kind = NONE;
+        int value = 0;
+    };
+    vector<Node> nodes;
+
+    static int slot(char ch) {
+        if (ch == ' ') return 26;
+        if (!isalpha((unsigned char)ch)) return -1;
+        return tolower((unsigned char)ch) - 'a';
+    }
+
+    void addWord(const string& word, TokenKind kind, int value) {
+        int node = 0;
+        for (char ch : word) {
+            int c = slot(ch);
+            if (nodes[node].next[c] == 0) {
+                nodes[node].next[c] = nodes.size();
+                nodes.emplace_back();
+            }
+            node = nodes[node].next[c];
+        }
+        nodes[node].kind = kind;
+        nodes[node].value = value;
+    }
+};
+
+// Chain recovered from a name: its length plus the substituents hanging off it
+struct ParsedChain {
+    int length = 0;
+    vector<pair<int, int>> halogens;  // (locant, halogen type)
+    vector<pair<int, int>> alkyls;    // (locant, index of the substituent chain)
+};
+
+// Recursive-descent parser for names produced by generateIUPACName:
+//   name     := prefix? Stem ("ane" | "an" "oic acid" | "yl")
+//   prefix   := entry ("-" entry)*
+//   entry    := locants "-" multiplier? substituent
+//   locants  := N ("," N)* | "(" N ("," N)* ")"   (bare inside complex substituents)
+//   multiplier := "di" | "tri" | N "-"
+//   substituent := halogen | stem "yl" | halomethyl | "(" (prefix stem | halomethyl) "yl" ")"
+//   halomethyl := ("di" | "tri")? halogen ... "methyl"   (one carbon, no locants)
+class NameParser {
+public:
+    vector<ParsedChain> chains;  // chains[0] is the parent chain
+    bool isAcid = false;
+    string error;
+
+    NameParser(const NameTrie& trie, const string& name) : trie(trie), text(name) {}
+
+    bool parse(bool expectYl) {
+        chains.clear();
+        chains.emplace_back();
+        if (!parsePrefix(0)) return false;
+        bool unnumbered = expectYl && parseUnnumberedHalogens(0);  // a halomethyl group on its own
+
+        NameTrie::Token stem = trie.match(text, pos);
+        if (stem.kind != NameTrie::STEM) return fail("expected a parent chain stem");
+        chains[0].length = stem.value;
+        pos += stem.length;
+        if (unnumbered && stem.value != 1) return fail("halogens without locants on a longer chain");
+
+        NameTrie::Token suffix = trie.match(text, pos);
+        if (expectYl) {
+            if (suffix.kind != NameTrie::SUFFIX_YL) return fail("expected 'yl'");
+        } else if (suffix.kind == NameTrie::SUFFIX_AN) {
+            pos += suffix.length;
+            suffix = trie.match(text, pos);
+            if (suffix.kind != NameTrie::SUFFIX_OIC_ACID) return fail("expected 'oic acid'");
+            isAcid = true;
+        } else if (suffix.kind != NameTrie::SUFFIX_ANE) {
+            return fail("expected 'ane' or 'anoic acid'");
+        }
+        pos += suffix.length;
+        if (pos != text.size()) return fail("unexpected trailing text");
+        return validate();
+    }
+
+private:
+    const NameTrie& trie;
+    const string& text;
+    size_t pos = 0;
+
+    bool fail(const string& message) {
+        error = message + " at position " + to_string(pos);
+        return false;
+    }
+
+    bool peek(char ch) const { return pos < text.size() && text[pos] == ch; }
+
+    bool expect(char ch) {
+        if (!peek(ch)) return fail(string("expected '") + ch + "'");
+        pos++;
+        return true;
+    }
+
+    bool parseNumber(int& value) {
+        if (pos >= text.size() || !isdigit((unsigned char)text[pos])) return fail("expected a number");
+        value = 0;
+        while (pos < text.size() && isdigit((unsigned char)text[pos])) {
+            value = value * 10 + (text[pos++] - '0');
+        }
+        return true;
+    }
+
+    bool parseLocants(vector<int>& locants) {
+        int value;
+        bool enclosed = peek('(');
+        if (enclosed) pos++;
+        do {
+            if (!parseNumber(value)) return false;
+            locants.push_back(value);
+        } while (peek(',') && ++pos);
+        return !enclosed || expect(')');
+    }
+
+    // Entries of a prefix; stops in front of the stem that follows it
+    bool parsePrefix(int chain) {
+        while (pos < text.size() && (isdigit((unsigned char)text[pos]) || peek('('))) {
+            vector<int> locants;
+            if (!parseLocants(locants) || !expect('-')) return false;
+
+            int count = 1;
+            if (pos < text.size() && isdigit((unsigned char)text[pos])) {
+                if (!parseNumber(count) || !expect('-')) return false;
+            } else {
+                NameTrie::Token multiplier = trie.match(text, pos);
+                if (multiplier.kind == NameTrie::MULTIPLIER) {
+                    count = multiplier.value;
+                    pos += multiplier.length;
+                }
+            }
+            if (count != (int)locants.size()) return fail("locant count does not match multiplier");
+
+            if (!parseSubstituent(chain, locants)) return false;
+            if (peek('-')) pos++;
+        }
+        return true;
+    }
+
+    bool parseSubstituent(int chain, const vector<int>& locants) {
+        int substituent = -1;
+        if (peek('(')) {
+            // Complex substituent: its own prefix, then stem + "yl"
+            pos++;
+            substituent = chains.size();
+            chains.emplace_back();
+            if (!parsePrefix(substituent)) return false;
+            bool unnumbered = parseUnnumberedHalogens(substituent);
+            if (!parseAlkylStem(substituent)) return false;
+            if (unnumbered && chains[substituent].length != 1) return fail("halogens without locants on a longer chain");
+            if (!expect(')')) return false;
+        } else {
+            // A halomethyl written bare (chloromethyl), a halogen or an alkyl
+            size_t start = pos;
+            substituent = chains.size();
+            chains.emplace_back();
+            if (!parseUnnumberedHalogens(substituent) || !atMethyl()) {
+                pos = start;
+                chains[substituent].halogens.clear();
+                NameTrie::Token token = trie.match(text, pos);
+                if (token.kind == NameTrie::HALOGEN) {
+                    chains.pop_back();
+                    pos += token.length;
+                    for (int locant : locants) chains[chain].halogens.emplace_back(locant, token.value);
+                    return true;
+                }
+            }
+            if (!parseAlkylStem(substituent)) return false;
+        }
+
+        for (size_t i = 0; i < locants.size(); i++) {
+            int copy = substituent;
+            if (i > 0) {
+                // Multiplied substituents each get their own copy of the chain tree
+                copy = chains.size();
+                cloneChain(substituent);
+            }
+            chains[chain].alkyls.emplace_back(locants[i], copy);
+        }
+        return true;
+    }
+
+    // Halogens written without locants before the stem of a one-carbon
+    // substituent (dichloro in dichloromethyl); false if there are none
+    bool parseUnnumberedHalogens(int chain) {
+        bool found = false;
+        while (true) {
+            size_t start = pos;
+            int count = 1;
+            NameTrie::Token token = trie.match(text, pos);
+            if (token.kind == NameTrie::MULTIPLIER) {
+                count = token.value;
+                pos += token.length;
+                token = trie.match(text, pos);
+            }
+            if (token.kind != NameTrie::HALOGEN) {
+                pos = start;
+                return found;
+            }
+            pos += token.length;
+            for (int n = 0; n < count; n++) chains[chain].halogens.emplace_back(1, token.value);
+            found = true;
+        }
+    }
+
+    // At a lowercase "methyl", which a parent chain stem ("Methyl") never is
+    bool atMethyl() const {
+        if (!peek('m')) return false;
+        NameTrie::Token stem = trie.match(text, pos);
+        return stem.kind == NameTrie::STEM && stem.value == 1 && trie.match(text, pos + stem.length).kind == NameTrie::SUFFIX_YL;
+    }
+
+    bool parseAlkylStem(int chain) {
+        NameTrie::Token stem = trie.match(text, pos);
+        if (stem.kind != NameTrie::STEM) return fail("expected a substituent stem");
+        pos += stem.length;
+        NameTrie::Token suffix = trie.match(text, pos);
+        if (suffix.kind != NameTrie::SUFFIX_YL) return fail("expected 'yl'");
+        pos += suffix.length;
+        chains[chain].length = stem.value;
+        return true;
+    }
+
+    int cloneChain(int source) {
+        int copy = chains.size();
+        chains.push_back(chains[source]);
+        for (auto& alkyl : chains[copy].alkyls) {
+            alkyl.second = cloneChain(alkyl.second);
+        }
+        return copy;
+    }
+
+    // Locants must fall on their chain and no carbon may exceed four bonds
+    bool validate() {
+        for (size_t c = 0; c < chains.size(); c++) {
+            const ParsedChain& chain = chains[c];
+            vector<int> bonds(chain.length + 1, 0);
+            for (int k = 1; k <= chain.length; k++) {
+                bonds[k] = (k > 1) + (k < chain.length) + (c > 0 && k == 1);
+            }
+            if (c == 0 && isAcid && chain.length > 0) bonds[chain.length] = 4;  // COOH carbon is saturated
+            for (const auto& halogen : chain.halogens) {
+                if (halogen.first < 1 || halogen.first > chain.length) return fail("locant out of range");
+                bonds[halogen.first]++;
+            }
+            for (const auto& alkyl : chain.alkyls) {
+                if (alkyl.first < 1 || alkyl.first > chain.length) return fail("locant out of range");
+                bonds[alkyl.first]++;
+            }
+            for (int k = 1; k <= chain.length; k++) {
+                if (bonds[k] > 4) return fail("carbon " + to_string(k) + " has more than four bonds");
+            }
+        }
+        return true;
+    }
+};
+
+// Builds the structure described by a parsed name into a MolecularGraph and
+// writes it out as a condensed formula the forward parser understands.
+// oxygenLocant marks the parent-chain carbon bonded to an ether oxygen.
+class StructureBuilder {
+public:
+    const vector<ParsedChain>& chains;
+    bool isAcid;
+    MolecularGraph graph;
+    string formula;
+
+    StructureBuilder(const vector<ParsedChain>& chains, bool isAcid, int oxygenLocant = 0) : chains(chains), isAcid(isAcid) {
+        buildChain(0, 0);
+        int oxygenAtom = oxygenLocant > 0 ? atomIds[0][oxygenLocant] : 0;
+        for (int id = 1; id < graph.counter; id++) {
+            int otherBonds = graph.degrees[id] + graph.halogenCount(id) + (id == oxygenAtom);
+            if (graph.kinds[id] == ELEMENT_C) graph.setHydrogens(id, 4 - otherBonds);
+        }
+        writeChain(0);
+    }
+
+private:
+    vector<vector<int>> atomIds;  // chain index -> graph ids of its atoms, 1-based
+
+    void buildChain(int chain, int attachTo) {
+        const ParsedChain& parsed = chains[chain];
+        atomIds.resize(chains.size());
+        atomIds[chain].assign(parsed.length + 1, 0);
+
+        int previous = attachTo;
+        for (int k = 1; k <= parsed.length; k++) {
+            bool cooh = chain == 0 && isAcid && k == parsed.length;
+            int current = graph.addAtom(cooh ? (AtomKind)KIND_COOH : (AtomKind)ELEMENT_C);
+            atomIds[chain][k] = current;
+            if (previous != 0) graph.addEdge(previous, current);
+            previous = current;
+        }
+        for (const auto& halogen : parsed.halogens) {
+            graph.addHalogen(atomIds[chain][halogen.first], halogen.second);
+        }
+        for (const auto& alkyl : parsed.alkyls) {
+            buildChain(alkyl.second, atomIds[chain][alkyl.first]);
+        }
+    }
+
+    static string halogenSymbol(int halogenType) {
+        switch (halogenType) {
+            case 1: return "Cl";
+            case 2: return "Br";
+            case 3: return "F";
+            default: return "I";
+        }
+    }
+
+    void writeChain(int chain) {
+        const ParsedChain& parsed = chains[chain];
+        for (int k = 1; k <= parsed.length; k++) {
+            int atom = atomIds[chain][k];
+            if (graph.kinds[atom] == KIND_COOH) {
+                formula += "COOH";
+                continue;
+            }
+            int hydrogens = graph.hydrogens[atom];
+            formula += "C";
+            if (hydrogens > 0) formula += "H";
+            if (hydrogens > 1) formula += to_string(hydrogens);
+
+            // Halogens of one type are written together, e.g. CHCl2
+            int counts[5] = {};
+            for (const auto& halogen : parsed.halogens) {
+                if (halogen.first == k) counts[halogen.second]++;
+            }
+            for (int halogenType = 1; halogenType <= 4; halogenType++) {
+                if (counts[halogenType] == 0) continue;
+                formula += halogenSymbol(halogenType);
+                if (counts[halogenType] > 1) formula += to_string(counts[halogenType]);
+            }
+
+            for (const auto& alkyl : parsed.alkyls) {
+                if (alkyl.first != k) continue;
+                formula += "(";
+                writeChain(alkyl.second);
+                formula += ")";
+            }
+        }
+    }
+};
+
+// Reverses one name into a condensed formula; ethers come back as R-O-R'
+bool reverseName(const NameTrie& trie, const string& name, string& formula, string& error) {
+    const string etherSuffix = " ether";
+    if (name.size() > etherSuffix.size() &&
+        name.compare(name.size() - etherSuffix.size(), etherSuffix.size(), etherSuffix) == 0) {
+        string groups = name.substr(0, name.size() - etherSuffix.size());
+        size_t space = groups.find(' ');
+        if (space == string::npos) {
+            error = "expected two alkyl groups before 'ether'";
+            return false;
+        }
+        string halves[2] = {groups.substr(0, space), groups.substr(space + 1)};
+        formula.clear();
+        for (int i = 0; i < 2; i++) {
+            NameParser parser(trie, halves[i]);
+            if (!parser.parse(true)) {
+                error = parser.error;
+                return false;
+            }
+            // The left group bonds to oxygen through its last carbon, the right one through its first
+            int oxygenLocant = i == 0 ? parser.chains[0].length : 1;
+            if (i > 0) formula += "-O-";
+            formula += StructureBuilder(parser.chains, false, oxygenLocant).formula;
+        }
+        return true;
+    }
+
+    NameParser parser(trie, name);
+    if (!parser.parse(false)) {
+        error = parser.error;
+        return false;
+    }
+    formula = StructureBuilder(parser.chains, parser.isAcid).formula;
+    return true;
+}
+
+// --reverse: one name per stdin line -> "name<TAB>formula" (or "ERROR: ...")
+int runReverseMode() {
+    NameTrie trie;
+    string name, formula, error;
+    while (getline(cin, name)) {
+        if (name.empty()) continue;
+        if (reverseName(trie, name, formula, error)) cout << name << "\t" << formula << "\n";
+        else cout << name << "\tERROR: " << error << "\n";
+    }
+    return 0;
+}
+
+// --roundtrip <corpus>: checks forward(reverse(name)) == name for every name
+// in the corpus, printing each mismatch and a throughput summary.
+int runRoundTripMode(const string& corpusPath) {
+    ifstream corpus(corpusPath);
+    if (!corpus) {
+        cerr << "Cannot open corpus: " << corpusPath << endl;
+        return 1;
+    }
+    vector<string> names;
+    string line;
+    while (getline(corpus, line)) {
+        if (!line.empty()) names.push_back(line);
+    }
+
+    NameTrie trie;
+    ostream& out = cout;
+
+    // Reverse direction, timed on its own
+    vector<string> formulas(names.size());
+    vector<string> errors(names.size());
+    auto reverseStart = chrono::steady_clock::now();
+    for (size_t i = 0; i < names.size(); i++) {
+        reverseName(trie, names[i], formulas[i], errors[i]);
+    }
+    double reverseSeconds = chrono::duration<double>(chrono::steady_clock::now() - reverseStart).count();
+
+    // Forward direction over the recovered formulas
+    size_t matched = 0, parseErrors = 0;
+    auto forwardStart = chrono::steady_clock::now();
+    for (size_t i = 0; i < names.size(); i++) {
+        if (!errors[i].empty()) {
+            parseErrors++;
+            out << "REVERSE ERROR\t" << names[i] << "\t" << errors[i] << "\n";
+            continue;
+        }
+        WorkBudget budget;
+        string forward = nameFormula<NoTrace>(formulas[i], budget);
+        if (forward == names[i]) matched++;
+        else out << "MISMATCH\t" << names[i] << "\t" << formulas[i] << "\t" << forward << "\n";
+    }
+    double forwardSeconds = chrono::duration<double>(chrono::steady_clock::now() - forwardStart).count();
+
+    out << "names=" << names.size() << " matched=" << matched
+        << " mismatched=" << names.size() - matched - parseErrors << " reverse_errors=" << parseErrors << "\n";
+    out << "reverse_names_per_s=" << (reverseSeconds > 0 ? names.size() / reverseSeconds : 0)
+        << " forward_names_per_s=" << (forwardSeconds > 0 ? names.size() / forwardSeconds : 0) << "\n";
+    return matched == names.size() ? 0 : 1;
+}
+
+// -------------------- Isomer Enumeration --------------------
+
+const int MAX_SKELETON_ATOMS = 64;
+
+// Carbon skeleton of an acyclic alkane (a tree with degree <= 4) plus the
+// number of halogens on each carbon. Atoms are added and removed as leaves.
+struct Skeleton {
+    int n = 0;
+    int degree[MAX_SKELETON_ATOMS] = {};
+    int adj[MAX_SKELETON_ATOMS][4] = {};
+    int halogens[MAX_SKELETON_ATOMS] = {};
+
+    void addLeaf(int parent) {
+        int leaf = n++;
+        degree[leaf] = 0;
+        halogens[leaf] = 0;
+        if (parent >= 0) {
+            adj[parent][degree[parent]++] = leaf;
+            adj[leaf][degree[leaf]++] = parent;
+        }
+    }
+
+    void removeLastLeaf() {
+        int leaf = --n;
+        if (degree[leaf] > 0) degree[adj[leaf][0]]--;
+    }
+
+    int hydrogens(int atom) const { return 4 - degree[atom] - halogens[atom]; }
+};
+
+// Hash of the skeleton rooted at every atom, computed for all roots at once
+// by rerooting. Children are combined by summing mixed hashes, so the result
+// is independent of child order and equal roots mean an automorphism maps
+// one atom onto the other (up to hash collisions).
+void rootedHashes(const Skeleton& t, uint64_t* full) {
+    int order[MAX_SKELETON_ATOMS], parent[MAX_SKELETON_ATOMS];
+    uint64_t down[MAX_SKELETON_ATOMS], childSum[MAX_SKELETON_ATOMS], up[MAX_SKELETON_ATOMS];
+    auto edge = [](uint64_t h) { return mixHash(h ^ 0x5851f42d4c957f2dULL); };
+    auto node = [&](int v, uint64_t sum) { return mixHash(sum + 0x1000 * (uint64_t)t.halogens[v]); };
+
+    // BFS order from atom 0
+    int head = 0, tail = 0;
+    order[tail++] = 0;
+    parent[0] = -1;
+    while (head < tail) {
+        int v = order[head++];
+        for (int i = 0; i < t.degree[v]; i++) {
+            int u = t.adj[v][i];
+            if (u == parent[v]) continue;
+            parent[u] = v;
+            order[tail++] = u;
+        }
+    }
+
+    for (int k = t.n - 1; k >= 0; k--) {
+        int v = order[k];
+        childSum[v] = 0;
+        for (int i = 0; i < t.degree[v]; i++) {
+            int u = t.adj[v][i];
+            if (u != parent[v]) childSum[v] += edge(down[u]);
+        }
+        down[v] = node(v, childSum[v]);
+    }
+
+    for (int k = 0; k < t.n; k++) {
+        int v = order[k];
+        uint64_t total = childSum[v] + (parent[v] >= 0 ? edge(up[v]) : 0);
+        full[v] = node(v, total);
+        for (int i = 0; i < t.degree[v]; i++) {
+            int u = t.adj[v][i];
+            if (u != parent[v]) up[u] = node(v, total - edge(down[u]));
+        }
+    }
+}
+
+// Canonical hash of the whole (halogen-labelled) skeleton
+uint64_t canonicalSkeletonHash(const Skeleton& t) {
+    uint64_t full[MAX_SKELETON_ATOMS];
+    rootedHashes(t, full);
+    return *max_element(full, full + t.n);
+}
+
+// Condensed formula for a skeleton, written from one end of its longest
+// chain so that chain reads inline and everything else is a parenthesised branch
+string skeletonFormula(const Skeleton& t, const string& halogenSymbol) {
+    // Farthest atom from atom 0 is an end of a longest chain
+    int dist[MAX_SKELETON_ATOMS], queue[MAX_SKELETON_ATOMS];
+    fill(dist, dist + t.n, -1);
+    int head = 0, tail = 0, root = 0;
+    dist[0] = 0;
+    queue[tail++] = 0;
+    while (head < tail) {
+        int v = queue[head++];
+        root = v;
+        for (int i = 0; i < t.degree[v]; i++) {
+            int u = t.adj[v][i];
+            if (dist[u] < 0) {
+                dist[u] = dist[v] + 1;
+                queue[tail++] = u;
+            }
+        }
+    }
+
+    int height[MAX_SKELETON_ATOMS];
+    function<int(int, int)> measure = [&](int v, int from) {
+        height[v] = 1;
+        for (int i = 0; i < t.degree[v]; i++) {
+            int u = t.adj[v][i];
+            if (u != from) height[v] = max(height[v], measure(u, v) + 1);
+        }
+        return height[v];
+    };
+    measure(root, -1);
+
+    string formula;
+    function<void(int, int)> write = [&](int v, int from) {
+        formula += "C";
+        int h = t.hydrogens(v);
+        if (h > 0) formula += "H";
+        if (h > 1) formula += to_string(h);
+        if (t.halogens[v] > 0) formula += halogenSymbol;
+        if (t.halogens[v] > 1) formula += to_string(t.halogens[v]);
+
+        // The tallest child continues inline, the rest are branches
+        int inlineChild = -1;
+        for (int i = 0; i < t.degree[v]; i++) {
+            int u = t.adj[v][i];
+            if (u != from && (inlineChild < 0 || height[u] > height[inlineChild])) inlineChild = u;
+        }
+        for (int i = 0; i < t.degree[v]; i++) {
+            int u = t.adj[v][i];
+            if (u == from || u == inlineChild) continue;
+            formula += "(";
+            write(u, v);
+            formula += ")";
+        }
+        if (inlineChild >= 0) write(inlineChild, v);
+    };
+    write(root, -1);
+    return formula;
+}
+
+// Enumerates every structural isomer of CnH2n+2 (optionally carrying k
+// halogens) by canonical augmentation: a skeleton grows one leaf at a time,
+// one attachment point per automorphism orbit, and a child is kept only if
+// the new leaf lies in the orbit of its canonical deletion leaf (the leaf
+// with the largest rooted hash). Each isomer is built straight into a
+// MolecularGraph and named in-process.
+class IsomerEnumerator {
+public:
+    int targetAtoms;
+    int halogenCount;
+    string halogenSymbol;
+    int halogenType;
+
+    IsomerEnumerator(int targetAtoms, int halogenCount, const string& halogenSymbol)
+        : targetAtoms(targetAtoms), halogenCount(halogenCount), halogenSymbol(halogenSymbol) {
+        size_t length;
+        halogenType = halogenAt(halogenSymbol, 0, length);
+    }
+
+    // Skeletons of `size` atoms; the top of the search that gets split across threads
+    vector<Skeleton> frontier(int size) {
+        vector<Skeleton> result;
+        Skeleton t;
+        t.addLeaf(-1);
+        grow(t, size, [&](Skeleton& s) { result.push_back(s); });
+        return result;
+    }
+
+    // Completes one frontier skeleton and names every isomer below it
+    void expand(Skeleton t, string& out, long long& count) {
+        grow(t, targetAtoms, [&](Skeleton& s) { placeHalogens(s, out, count); });
+    }
+
+private:
+    template <typename Visit>
+    void grow(Skeleton& t, int size, Visit&& visit) {
+        if (t.n == size) {
+            visit(t);
+            return;
+        }
+
+        uint64_t full[MAX_SKELETON_ATOMS];
+        rootedHashes(t, full);
+        uint64_t tried[MAX_SKELETON_ATOMS];
+        int triedCount = 0;
+
+        for (int v = 0; v < t.n; v++) {
+            if (t.degree[v] >= 4) continue;
+            // One attachment point per orbit
+            if (find(tried, tried + triedCount, full[v]) != tried + triedCount) continue;
+            tried[triedCount++] = full[v];
+
+            t.addLeaf(v);
+            int leaf = t.n - 1;
+            if (isCanonicalAddition(t, leaf)) grow(t, size, visit);
+            t.removeLastLeaf();
+        }
+    }
+
+    static bool isCanonicalAddition(const Skeleton& t, int leaf) {
+        uint64_t full[MAX_SKELETON_ATOMS];
+        rootedHashes(t, full);
+        uint64_t best = 0;
+        for (int v = 0; v < t.n; v++) {
+            if (t.degree[v] == 1) best = max(best, full[v]);
+        }
+        return full[leaf] == best;
+    }
+
+    // Every distinct way of putting the halogens on the skeleton's hydrogens
+    void placeHalogens(Skeleton& t, string& out, long long& count) {
+        if (halogenCount == 0) {
+            emit(t, out, count);
+            return;
+        }
+        unordered_set<uint64_t> seen;
+        function<void(int, int)> place = [&](int from, int left) {
+            if (left == 0) {
+                if (seen.insert(canonicalSkeletonHash(t)).second) emit(t, out, count);
+                return;
+            }
+            for (int v = from; v < t.n; v++) {
+                if (t.hydrogens(v) == 0) continue;
+                t.halogens[v]++;
+                place(v, left - 1);
+                t.halogens[v]--;
+            }
+        };
+        place(0, halogenCount);
+    }
+
+    void emit(const Skeleton& t, string& out, long long& count) {
+        MolecularGraph molecule;
+        for (int v = 0; v < t.n; v++) molecule.addAtom(ELEMENT_C);
+        for (int v = 0; v < t.n; v++) {
+            for (int i = 0; i < t.degree[v]; i++) {
+                if (t.adj[v][i] > v) molecule.addEdge(v + 1, t.adj[v][i] + 1);
+            }
+            molecule.setHydrogens(v + 1, t.hydrogens(v));
+            for (int x = 0; x < t.halogens[v]; x++) molecule.addHalogen(v + 1, halogenType);
+        }
+
+        WorkBudget budget;
+        string name = processMolecularGraph<NoTrace>(molecule, 0, budget);
+        out += skeletonFormula(t, halogenSymbol);
+        out += "\t";
+        out += name;
+        out += "\n";
+        count++;
+    }
+};
+
+// --isomers N [--halogens K] [--halogen X] [--threads T]: names every
+// structural isomer, one "formula<TAB>name" line each, and reports
+// isomers/s on stderr. Threads take frontier skeletons from a shared
+// counter; output keeps frontier order so runs are reproducible.
+int runIsomerMode(int carbons, int halogenCount, const string& halogenSymbol, int threadCount) {
+    if (carbons < 1 || carbons > MAX_SKELETON_ATOMS) {
+        cerr << "Carbon count must be between 1 and " << MAX_SKELETON_ATOMS << endl;
+        return 1;
+    }
+    size_t length;
+    if (halogenCount > 0 && (halogenSymbol.empty() || halogenAt(halogenSymbol, 0, length) == 0 || length != halogenSymbol.size())) {
+        cerr << "Unknown halogen: " << halogenSymbol << endl;
+        return 1;
+    }
+    if (threadCount < 1) threadCount = max(1u, thread::hardware_concurrency());
+
+    ostream& out = cout;
+    auto start = chrono::steady_clock::now();
+
+    IsomerEnumerator enumerator(carbons, halogenCount, halogenSymbol);
+    vector<Skeleton> frontier = enumerator.frontier(min(carbons, 12));
+    vector<string> results(frontier.size());
+    vector<long long> counts(threadCount, 0);
+    atomic<size_t> next(0);
+
+    vector<thread> workers;
+    for (int w = 0; w < threadCount; w++) {
+        workers.emplace_back([&, w]() {
+            for (size_t i = next++; i < frontier.size(); i = next++) {
+                enumerator.expand(frontier[i], results[i], counts[w]);
+            }
+        });
+    }
+    for (thread& worker : workers) worker.join();
+
+    long long total = 0;
+    for (long long count : counts) total += count;
+    for (const string& chunk : results) out << chunk;
+    out.flush();
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << "isomers=" << total << " threads=" << threadCount << " seconds=" << seconds
+         << " isomers_per_s=" << (seconds > 0 ? total / seconds : 0) << endl;
+    return 0;
+}
+
+// -------------------- Name Cache --------------------
+
+// Names computed by any engine process on the host, kept in one shared file.
+// The file is an open-addressing table of fixed-size slots mapped MAP_SHARED
+// by every process. A slot goes EMPTY -> CLAIMED (CAS by the one inserting
+// writer) -> READY (release store once the body is written) and is never
+// changed again, so lookups need no locks: they acquire-load the state and
+// only trust READY slots. Slots left CLAIMED by a crashed writer are skipped,
+// and two writers racing on one key may both store it; --cache-compact drops
+// both kinds of waste.
+//
+// The header records NAMING_RULES_VERSION. A cache written by an engine
+// with other naming rules is replaced by an empty one when opened for
+// naming, so stale names are never served.
+const char NAME_CACHE_MAGIC[8] = {'O', 'C', 'T', 'N', 'C', '\0', '\0', '\0'};
+const uint32_t NAME_CACHE_VERSION = 2;
+const uint64_t NAME_CACHE_DEFAULT_SLOTS = 1 << 16;
+const int NAME_CACHE_MAX_PROBES = 64;
+
+enum NameCacheSlotState : uint64_t { SLOT_EMPTY, SLOT_CLAIMED, SLOT_READY };
+
+struct NameCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t slotBytes;
+    uint64_t slotCount;   // power of two
+    uint64_t maxEntries;  // inserts stop here to keep probe chains short
+    uint64_t entries;     // updated atomically
+    uint64_t rejected;    // inserts dropped for size, updated atomically
+    uint32_t rulesVersion;  // NAMING_RULES_VERSION of the engine that created it
+    char padding[12];
+};
+
+struct NameCacheSlot {
+    uint64_t state;
+    uint64_t hash;
+    uint32_t elementCounts[ELEMENT_COUNT];
+    uint32_t steps;
+    uint16_t keyLength;
+    uint16_t nameLength;
+    char text[184];  // key, then name
+};
+
+// A cached naming result
+struct CachedName {
+    string name;
+    MolecularProperties properties;
+    uint32_t steps = 0;
+};
+
+// Cache key: the formula with whitespace removed
+string normalizedFormula(const string& formula) {
+    string key;
+    for (char ch : formula) {
+        if (!isspace((unsigned char)ch)) key += ch;
+    }
+    return key;
+}
+
+class NameCache {
+public:
+    NameCache() = default;
+    NameCache(const NameCache&) = delete;
+    NameCache& operator=(const NameCache&) = delete;
+    ~NameCache() {
+        if (header) munmap(header, length);
+    }
+
+    // Maps the cache at `path`, creating it with `slotCount` slots if it does
+    // not exist yet, or replacing it if it was written under other naming
+    // rules. Creation writes a temporary file and links it into place, so
+    // racing processes all end up mapping the same complete file. A
+    // slotCount of 0 only opens an existing, current cache.
+    bool open(const string& path, uint64_t slotCount = NAME_CACHE_DEFAULT_SLOTS) {
+        int fd = ::open(path.c_str(), O_RDWR);
+        if (fd < 0 && errno == ENOENT && slotCount > 0) {
+            if (!create(path, slotCount)) return false;
+            fd = ::open(path.c_str(), O_RDWR);
+        }
+        if (fd < 0) return false;
+        NameCacheHeader existing = {};
+        if (slotCount > 0 && pread(fd, &existing, sizeof(existing), 0) == (ssize_t)sizeof(existing) &&
+            memcmp(existing.magic, NAME_CACHE_MAGIC, sizeof(NAME_CACHE_MAGIC)) == 0 &&
+            (existing.version != NAME_CACHE_VERSION || existing.rulesVersion != NAMING_RULES_VERSION)) {
+            close(fd);
+            if (!create(path, slotCount, true)) return false;
+            fd = ::open(path.c_str(), O_RDWR);
+            if (fd < 0) return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(NameCacheHeader)) {
+            close(fd);
+            return false;
+        }
+        length = info.st_size;
+        void* mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) return false;
+        header = (NameCacheHeader*)mapped;
+        slots = (NameCacheSlot*)(header + 1);
+        if (memcmp(header->magic, NAME_CACHE_MAGIC, sizeof(NAME_CACHE_MAGIC)) != 0 ||
+            header->version != NAME_CACHE_VERSION || header->rulesVersion != NAMING_RULES_VERSION ||
+            header->slotBytes != sizeof(NameCacheSlot) ||
+            sizeof(NameCacheHeader) + header->slotCount * sizeof(NameCacheSlot) > length) {
+            munmap(header, length);
+            header = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+    bool lookup(const string& key, CachedName& result) const {
+        uint64_t hash = stableHash(key);
+        uint64_t mask = header->slotCount - 1;
+        for (int probe = 0; probe < NAME_CACHE_MAX_PROBES; probe++) {
+            const NameCacheSlot& slot = slots[(hash + probe) & mask];
+            uint64_t state = __atomic_load_n(&slot.state, __ATOMIC_ACQUIRE);
+            if (state == SLOT_EMPTY) return false;
+            if (state != SLOT_READY || slot.hash != hash || slot.keyLength != key.size() ||
+                memcmp(slot.text, key.data(), key.size()) != 0) {
+                continue;
+            }
+            result.name.assign(slot.text + slot.keyLength, slot.nameLength);
+            for (int e = 0; e < ELEMENT_COUNT; e++) result.properties.counts[e] = slot.elementCounts[e];
+            result.steps = slot.steps;
+            return true;
+        }
+        return false;
+    }
+
+    // Stores a result unless the key is already present, the entry does not
+    // fit a slot or the table is at its size limit
+    bool insert(const string& key, const CachedName& value) {
+        if (key.size() + value.name.size() > sizeof(NameCacheSlot::text)) return reject();
+        if (__atomic_load_n(&header->entries, __ATOMIC_RELAXED) >= header->maxEntries) return reject();
+
+        uint64_t hash = stableHash(key);
+        uint64_t mask = header->slotCount - 1;
+        for (int probe = 0; probe < NAME_CACHE_MAX_PROBES; probe++) {
+            NameCacheSlot& slot = slots[(hash + probe) & mask];
+            uint64_t state = __atomic_load_n(&slot.state, __ATOMIC_ACQUIRE);
+            if (state == SLOT_READY && slot.hash == hash && slot.keyLength == key.size() &&
+                memcmp(slot.text, key.data(), key.size()) == 0) {
+                return false;
+            }
+            if (state != SLOT_EMPTY) continue;
+
+            uint64_t expected = SLOT_EMPTY;
+            if (!__atomic_compare_exchange_n(&slot.state, &expected, (uint64_t)SLOT_CLAIMED, false,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                continue;  // another writer took it first
+            }
+            slot.hash = hash;
+            for (int e = 0; e < ELEMENT_COUNT; e++) slot.elementCounts[e] = value.properties.counts[e];
+            slot.steps = value.steps;
+            slot.keyLength = key.size();
+            slot.nameLength = value.name.size();
+            memcpy(slot.text, key.data(), key.size());
+            memcpy(slot.text + key.size(), value.name.data(), value.name.size());
+            __atomic_store_n(&slot.state, (uint64_t)SLOT_READY, __ATOMIC_RELEASE);
+            __atomic_fetch_add(&header->entries, 1, __ATOMIC_RELAXED);
+            return true;
+        }
+        return reject();
+    }
+
+    const NameCacheHeader& info() const { return *header; }
+    const NameCacheSlot& slot(uint64_t i) const { return slots[i]; }
+
+    // Writes an empty cache of `slotCount` slots (rounded up to a power of
+    // two); `replace` renames it over an existing file
+    static bool create(const string& path, uint64_t slotCount, bool replace = false) {
+        uint64_t count = 1;
+        while (count < slotCount) count <<= 1;
+        string temp = path + ".tmp." + to_string(getpid());
+        int fd = ::open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+
+        NameCacheHeader initial = {};
+        memcpy(initial.magic, NAME_CACHE_MAGIC, sizeof(NAME_CACHE_MAGIC));
+        initial.version = NAME_CACHE_VERSION;
+        initial.rulesVersion = NAMING_RULES_VERSION;
+        initial.slotBytes = sizeof(NameCacheSlot);
+        initial.slotCount = count;
+        initial.maxEntries = count * 3 / 4;
+        bool ok = ftruncate(fd, sizeof(NameCacheHeader) + count * sizeof(NameCacheSlot)) == 0 &&
+                  pwrite(fd, &initial, sizeof(initial), 0) == (ssize_t)sizeof(initial);
+        close(fd);
+        if (replace) {
+            ok = ok && rename(temp.c_str(), path.c_str()) == 0;
+            if (!ok) unlink(temp.c_str());
+            return ok;
+        }
+        // link() fails if another process created the cache first; theirs is used
+        ok = ok && (link(temp.c_str(), path.c_str()) == 0 || errno == EEXIST);
+        unlink(temp.c_str());
+        return ok;
+    }
+
+private:
+    NameCacheHeader* header = nullptr;
+    NameCacheSlot* slots = nullptr;
+    size_t length = 0;
+
+    bool reject() {
+        __atomic_fetch_add(&header->rejected, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+};
+
+// Names `formula` through the cache: a hit skips parsing and naming, a
+// computed result is stored unless the budget cut the run off
+template <class Trace>
+string nameFormulaCached(NameCache* cache, const string& formula, WorkBudget& budget,
+                         MolecularProperties* properties) {
+    if (!cache) return nameFormula<Trace>(formula, budget, properties);
+
+    string key = normalizedFormula(formula);
+    CachedName cached;
+    if (cache->lookup(key, cached)) {
+        if (properties) *properties = cached.properties;
+        budget.steps = cached.steps;
+        return cached.name;
+    }
+    string name = nameFormula<Trace>(formula, budget, &cached.properties);
+    if (properties) *properties = cached.properties;
+    if (!budget.exceeded) {
+        cached.name = name;
+        cached.steps = budget.steps;
+        cache->insert(key, cached);
+    }
+    return name;
+}
+
+// --cache-compact PATH [--cache-slots N]: rewrites the cache with only its
+// finished entries, sized for N slots (default: twice the entry count), and
+// renames it over the original. Processes that still map the old file keep
+// reading it until they reopen.
+int runCacheCompactMode(const string& path, uint64_t slotCount) {
+    NameCache old;
+    if (!old.open(path, 0)) {
+        cerr << "Not a name cache: " << path << endl;
+        return 1;
+    }
+    uint64_t live = 0;
+    for (uint64_t i = 0; i < old.info().slotCount; i++) {
+        if (__atomic_load_n(&old.slot(i).state, __ATOMIC_ACQUIRE) == SLOT_READY) live++;
+    }
+    if (slotCount == 0) slotCount = max<uint64_t>(1024, live * 2);
+
+    string compacted = path + ".compact." + to_string(getpid());
+    unlink(compacted.c_str());
+    NameCache fresh;
+    if (!NameCache::create(compacted, slotCount) || !fresh.open(compacted, 0)) {
+        cerr << "Cannot create " << compacted << endl;
+        return 1;
+    }
+    uint64_t kept = 0, dropped = old.info().entries - live;
+    for (uint64_t i = 0; i < old.info().slotCount; i++) {
+        const NameCacheSlot& slot = old.slot(i);
+        if (__atomic_load_n(&slot.state, __ATOMIC_ACQUIRE) != SLOT_READY) continue;
+        CachedName value;
+        value.name.assign(slot.text + slot.keyLength, slot.nameLength);
+        for (int e = 0; e < ELEMENT_COUNT; e++) value.properties.counts[e] = slot.elementCounts[e];
+        value.steps = slot.steps;
+        if (fresh.insert(string(slot.text, slot.keyLength), value)) kept++;
+        else dropped++;
+    }
+    if (rename(compacted.c_str(), path.c_str()) != 0) {
+        cerr << "Cannot replace " << path << endl;
+        unlink(compacted.c_str());
+        return 1;
+    }
+    cerr << "entries=" << kept << " dropped=" << dropped << " slots=" << fresh.info().slotCount << endl;
+    return 0;
+}
+
+// --cache-stats PATH
+int runCacheStatsMode(const string& path) {
+    NameCache cache;
+    if (!cache.open(path, 0)) {
+        cerr << "Not a name cache: " << path << endl;
+        return 1;
+    }
+    const NameCacheHeader& info = cache.info();
+    cout << "slots=" << info.slotCount << " entries=" << info.entries << " max_entries=" << info.maxEntries
+         << " rejected=" << info.rejected << " bytes=" << sizeof(NameCacheHeader) + info.slotCount * sizeof(NameCacheSlot)
+         << " rules_version=" << info.rulesVersion << endl;
+    return 0;
+}
+
+// -------------------- Small-Molecule Kernel --------------------
+
+// Names many small molecules in one pass. Up to LANES all-carbon trees of
+// at most ATOMS atoms are laid out side by side, one lane per molecule and
+// every array indexed [atom][lane]: adjacency as 16-bit masks, hydrogen
+// counts and halogen flags as byte lanes. Degrees, terminal atoms,
+// ring-closure candidates and the distance levels from every atom are
+// computed for all lanes together by branch-free loops over the lanes,
+// which the compiler turns into vector code. Only the choice among the
+// longest chains and the name itself are worked out per molecule, on the
+// masks. Molecules with groups, (CH2)n runs, mixed halogens on one carbon
+// or more atoms are left to the per-molecule path, as is any molecule the
+// kernel cannot name exactly as that path would.
+class SmallMoleculeKernel {
+public:
+    static const int ATOMS = 16;  // one bit each in the adjacency masks
+    static const int LANES = 64;
+
+    int size = 0;  // lanes in use
+
+    // Packs a parsed molecule into the next free lane; -1 if the kernel does not take it
+    int add(const MolecularGraph& molecule) {
+        int atoms = molecule.counter - 1;
+        if (size == LANES || atoms < 2 || atoms > ATOMS || (int)molecule.edges.size() != atoms - 1) return -1;
+        for (int id = 1; id <= atoms; id++) {
+            if (molecule.kinds[id] != ELEMENT_C || molecule.flags[id] & FLAG_RUN || molecule.halogenType(id) == HALOGEN_MIXED) return -1;
+        }
+        int lane = size++;
+        atomCount[lane] = atoms;
+        for (int a = 0; a < ATOMS; a++) {
+            adjacency[a][lane] = 0;
+            hydrogens[a][lane] = a < atoms ? molecule.hydrogens[a + 1] : 0;
+            halogens[a][lane] = a < atoms ? molecule.flags[a + 1] : 0;
+        }
+        for (const auto& edge : molecule.edges) {
+            adjacency[edge.first - 1][lane] |= 1 << (edge.second - 1);
+            adjacency[edge.second - 1][lane] |= 1 << (edge.first - 1);
+        }
+        return lane;
+    }
+
+    // Names every packed lane and empties the batch. names[lane] is left
+    // empty where the per-molecule path has to name the molecule.
+    void run(vector<string>& names) {
+        int width = 0;  // atoms in the largest molecule
+        for (int lane = 0; lane < size; lane++) width = max(width, (int)atomCount[lane]);
+        computeDegrees(width);
+        computeDistances(width);
+        names.assign(size, "");
+        for (int lane = 0; lane < size; lane++) names[lane] = nameLane(lane);
+        size = 0;
+    }
+
+private:
+    // ParentChainSelector only names the first 32 tied chains
+    static const int MAX_TIED_CHAINS = 32;
+
+    struct Chain {
+        uint8_t atoms[ATOMS];   // locant order
+        uint8_t counts[ATOMS];  // substituents at each locant
+        uint16_t mask;
+        int total;
+    };
+
+    // Branch analysis as SubstituentNamer does it, by atom
+    struct Branch {
+        int depth, substituents, next;
+        int subtree;  // canonical id, as in SubstituentNamer
+        uint16_t children;
+    };
+
+    // Subtree keys of one lane: halogen flags and sorted child ids. A tree of
+    // ATOMS atoms has fewer than 2 * ATOMS rooted subtrees.
+    struct Subtree {
+        uint8_t flags, count;
+        uint8_t children[ATOMS];
+    };
+
+    alignas(64) uint16_t adjacency[ATOMS][LANES];
+    alignas(64) uint8_t hydrogens[ATOMS][LANES];
+    alignas(64) uint8_t halogens[ATOMS][LANES];  // MolecularGraph flags: halogen count and type
+    alignas(64) uint8_t atomCount[LANES];
+
+    alignas(64) uint8_t degrees[ATOMS][LANES];
+    alignas(64) uint16_t terminals[LANES];
+    alignas(64) uint8_t ringCandidates[LANES];  // carbons hasCyclicEdge would close a ring between
+    alignas(64) uint8_t eccentricity[ATOMS][LANES];
+    alignas(64) uint8_t diameter[LANES];       // bonds on the longest chains
+    alignas(64) uint8_t connected[LANES];
+    alignas(64) uint16_t levels[ATOMS][ATOMS][LANES];  // [source][distance]: atoms that far from the source
+
+    vector<Chain> tied;
+    Branch branches[ATOMS];
+    Subtree subtrees[2 * ATOMS];
+    int subtreeCount;
+    // Two different branches tied for the substituent chain; SubstituentNamer
+    // settles that by locants and names, so the lane goes back to it
+    bool unresolvedTie;
+    string bondNames[ATOMS][ATOMS];  // substituent hanging off [atom] through [neighbour]
+    uint16_t bondNamed[ATOMS];
+
+    // The lane loops work on local arrays and copy the result out, so the
+    // compiler can see that a store does not alias the masks it reads
+    void computeDegrees(int width) {
+        alignas(64) uint16_t terminal[LANES] = {};
+        alignas(64) uint8_t candidates[LANES] = {}, atoms[LANES];
+        memcpy(atoms, atomCount, sizeof(atoms));
+        for (int a = 0; a < width; a++) {
+            alignas(64) uint16_t masks[LANES];
+            alignas(64) uint8_t degree[LANES] = {}, hydrogen[LANES], halogen[LANES];
+            memcpy(masks, adjacency[a], sizeof(masks));
+            memcpy(hydrogen, hydrogens[a], sizeof(hydrogen));
+            memcpy(halogen, halogens[a], sizeof(halogen));
+            for (int b = 0; b < width; b++) {
+                for (int l = 0; l < LANES; l++) degree[l] += (masks[l] >> b) & 1;
+            }
+            for (int l = 0; l < LANES; l++) {
+                terminal[l] |= (uint16_t)((degree[l] == 1) << a);
+                uint8_t bonds = degree[l] + hydrogen[l] + (halogen[l] & FLAG_HALOGEN_COUNT);
+                candidates[l] += (bonds == 3) & (a < atoms[l]);
+            }
+            memcpy(degrees[a], degree, sizeof(degree));
+        }
+        memcpy(terminals, terminal, sizeof(terminal));
+        memcpy(ringCandidates, candidates, sizeof(candidates));
+    }
+
+    // Breadth-first search from every atom of every lane at once; the
+    // frontiers are masks, so a level is one OR of neighbour masks per atom
+    void computeDistances(int width) {
+        alignas(64) uint16_t masks[ATOMS][LANES];
+        alignas(64) uint8_t atoms[LANES], longest[LANES] = {};
+        memcpy(masks, adjacency, sizeof(masks));
+        memcpy(atoms, atomCount, sizeof(atoms));
+        for (int s = 0; s < width; s++) {
+            alignas(64) uint16_t frontier[LANES], reached[LANES];
+            alignas(64) uint8_t farthest[LANES] = {};
+            for (int l = 0; l < LANES; l++) frontier[l] = reached[l] = (uint16_t)((s < atoms[l]) << s);
+            memcpy(levels[s][0], frontier, sizeof(frontier));
+            for (int k = 1; k < width; k++) {
+                alignas(64) uint16_t next[LANES] = {};
+                for (int a = 0; a < width; a++) {
+                    for (int l = 0; l < LANES; l++) next[l] |= masks[a][l] & (uint16_t)-((frontier[l] >> a) & 1);
+                }
+                uint16_t any = 0;
+                for (int l = 0; l < LANES; l++) {
+                    next[l] &= ~reached[l];
+                    reached[l] |= next[l];
+                    frontier[l] = next[l];
+                    farthest[l] += next[l] != 0;
+                    any |= next[l];
+                }
+                memcpy(levels[s][k], next, sizeof(next));
+                if (!any) break;
+            }
+            for (int l = 0; l < LANES; l++) longest[l] = max(longest[l], farthest[l]);
+            memcpy(eccentricity[s], farthest, sizeof(farthest));
+            if (s == 0) {
+                for (int l = 0; l < LANES; l++) connected[l] = reached[l] == (uint16_t)((1u << atoms[l]) - 1);
+            }
+        }
+        memcpy(diameter, longest, sizeof(longest));
+    }
+
+    // Higher substituent total, then more substituents at the first point of difference
+    static int compareChains(const Chain& a, const Chain& b, int length) {
+        if (a.total != b.total) return a.total > b.total ? 1 : -1;
+        for (int k = 0; k < length; k++) {
+            if (a.counts[k] != b.counts[k]) return a.counts[k] > b.counts[k] ? 1 : -1;
+        }
+        return 0;
+    }
+
+    // Post-order over the branch at `root`, entered from `rootParent`, with
+    // an explicit stack as SubstituentNamer::analyze walks it
+    void analyze(int lane, int root, int rootParent) {
+        uint8_t stack[ATOMS], stackParents[ATOMS], order[ATOMS], orderParents[ATOMS];
+        int top = 0, count = 0;
+        stack[top] = root;
+        stackParents[top++] = rootParent;
+        while (top) {
+            top--;
+            int node = stack[top], parent = stackParents[top];
+            order[count] = node;
+            orderParents[count++] = parent;
+            for (uint16_t rest = adjacency[node][lane] & ~(1 << parent); rest; rest &= rest - 1) {
+                stack[top] = __builtin_ctz(rest);
+                stackParents[top++] = node;
+            }
+        }
+        while (count--) combine(lane, order[count], orderParents[count]);
+    }
+
+    // Fills branches[node] from its children, which are already analysed
+    void combine(int lane, int node, int parent) {
+        Branch info = {0, 0, -1, 0, 0};
+        uint8_t flags = halogens[node][lane];
+        int halogenCount = flags & FLAG_HALOGEN_COUNT, childCount = 0;
+        uint8_t childIds[ATOMS];
+        for (uint16_t rest = adjacency[node][lane] & ~(1 << parent); rest; rest &= rest - 1) {
+            int child = __builtin_ctz(rest);
+            const Branch& branch = branches[child];
+            info.children |= 1 << child;
+            childIds[childCount++] = branch.subtree;
+            if (info.next == -1) {
+                info.next = child;
+                continue;
+            }
+            const Branch& best = branches[info.next];
+            if (branch.depth != best.depth || branch.substituents != best.substituents) {
+                if (branch.depth != best.depth ? branch.depth > best.depth : branch.substituents > best.substituents) info.next = child;
+            } else if (branch.subtree != best.subtree) {
+                unresolvedTie = true;
+            }
+        }
+        info.depth = 1;
+        info.substituents = halogenCount + childCount;
+        if (info.next != -1) {
+            info.depth += branches[info.next].depth;
+            info.substituents += branches[info.next].substituents - 1;
+        }
+        info.subtree = subtreeId(flags, childIds, childCount);
+        branches[node] = info;
+    }
+
+    int subtreeId(uint8_t flags, uint8_t* children, int count) {
+        sort(children, children + count);
+        for (int id = 0; id < subtreeCount; id++) {
+            const Subtree& known = subtrees[id];
+            if (known.flags == flags && known.count == count && memcmp(known.children, children, count) == 0) return id;
+        }
+        Subtree& added = subtrees[subtreeCount];
+        added.flags = flags;
+        added.count = count;
+        memcpy(added.children, children, count);
+        return subtreeCount++;
+    }
+
+    string branchName(int lane, int node) {
+        vector<string> entries;
+        int locant = 1;
+        for (int atom = node; atom != -1; locant++, atom = branches[atom].next) {
+            uint8_t flags = halogens[atom][lane];
+            for (int n = 0; n < (flags & FLAG_HALOGEN_COUNT); n++) {
+                entries.push_back(to_string(locant) + "-" + formatBranchName(0, halogenTypeOf(flags)));
+            }
+            uint16_t children = branches[atom].children;
+            if (branches[atom].next != -1) children &= ~(1 << branches[atom].next);
+            for (; children; children &= children - 1) {
+                entries.push_back(to_string(locant) + "-" + branchName(lane, __builtin_ctz(children)));
+            }
+        }
+        return substituentName(entries, branches[node].depth);
+    }
+
+    const string& bondName(int lane, int atom, int neighbor) {
+        if (!(bondNamed[atom] & 1 << neighbor)) {
+            analyze(lane, neighbor, atom);
+            bondNames[atom][neighbor] = branchName(lane, neighbor);
+            bondNamed[atom] |= 1 << neighbor;
+        }
+        return bondNames[atom][neighbor];
+    }
+
+    // Locants of the substituents in alphabetical order of their names
+    vector<int> alphabeticalLocants(int lane, const Chain& chain, int length) {
+        vector<pair<string, int>> cited;
+        for (int k = 0; k < length; k++) {
+            int atom = chain.atoms[k];
+            uint8_t flags = halogens[atom][lane];
+            for (int n = 0; n < (flags & FLAG_HALOGEN_COUNT); n++) cited.emplace_back(formatBranchName(0, halogenTypeOf(flags)), k + 1);
+            for (uint16_t rest = adjacency[atom][lane] & ~chain.mask; rest; rest &= rest - 1) {
+                string letters;
+                for (char ch : bondName(lane, atom, __builtin_ctz(rest))) {
+                    if (isalpha(ch)) letters += ch;
+                }
+                cited.emplace_back(letters, k + 1);
+            }
+        }
+        sort(cited.begin(), cited.end());
+        vector<int> locants;
+        for (const auto& entry : cited) locants.push_back(entry.second);
+        return locants;
+    }
+
+    string chainName(int lane, const Chain& chain, int length) {
+        vector<string> entries;
+        for (int k = 0; k < length; k++) {
+            int atom = chain.atoms[k];
+            uint8_t flags = halogens[atom][lane];
+            for (int n = 0; n < (flags & FLAG_HALOGEN_COUNT); n++) {
+                entries.push_back(to_string(k + 1) + "-" + formatBranchName(0, halogenTypeOf(flags)));
+            }
+            for (uint16_t rest = adjacency[atom][lane] & ~chain.mask; rest; rest &= rest - 1) {
+                entries.push_back(to_string(k + 1) + "-" + bondName(lane, atom, __builtin_ctz(rest)));
+            }
+        }
+        return joinSubstituentPrefix(entries) + chainStem(length) + "ane";
+    }
+
+    string nameLane(int lane) {
+        if (!connected[lane] || ringCandidates[lane] >= 2) return "";
+        int bonds = diameter[lane], length = bonds + 1;
+
+        // Every longest chain joins two atoms `bonds` apart, and its k-th
+        // atom is the one k bonds from the first end and bonds - k from the
+        // other. Both directions are listed.
+        tied.clear();
+        for (int s = 0; s < atomCount[lane]; s++) {
+            if (eccentricity[s][lane] != bonds) continue;
+            for (uint16_t ends = levels[s][bonds][lane]; ends; ends &= ends - 1) {
+                int t = __builtin_ctz(ends);
+                Chain chain;
+                chain.mask = 0;
+                chain.total = 0;
+                for (int k = 0; k < length; k++) {
+                    chain.atoms[k] = __builtin_ctz(levels[s][k][lane] & levels[t][bonds - k][lane]);
+                    chain.mask |= 1 << chain.atoms[k];
+                }
+                for (int k = 0; k < length; k++) {
+                    int atom = chain.atoms[k];
+                    chain.counts[k] = __builtin_popcount(adjacency[atom][lane] & ~chain.mask) + (halogens[atom][lane] & FLAG_HALOGEN_COUNT);
+                    chain.total += chain.counts[k];
+                }
+                int order = tied.empty() ? 1 : compareChains(chain, tied[0], length);
+                if (order > 0) tied.clear();
+                if (order >= 0) tied.push_back(chain);
+            }
+        }
+        if (tied.empty() || tied.size() > MAX_TIED_CHAINS) return "";
+
+        for (int a = 0; a < atomCount[lane]; a++) bondNamed[a] = 0;
+        subtreeCount = 0;
+        unresolvedTie = false;
+        if (tied.size() == 1) {
+            string name = chainName(lane, tied[0], length);
+            return unresolvedTie ? "" : name;
+        }
+
+        // Alphabetical rule; chains it cannot separate must give the same name
+        vector<vector<int>> locants;
+        for (const Chain& chain : tied) locants.push_back(alphabeticalLocants(lane, chain, length));
+        vector<int> lowest = *min_element(locants.begin(), locants.end());
+        string name;
+        for (size_t k = 0; k < tied.size(); k++) {
+            if (locants[k] != lowest) continue;
+            string candidate = chainName(lane, tied[k], length);
+            if (!name.empty() && candidate != name) return "";
+            name = candidate;
+        }
+        return unresolvedTie ? "" : name;
+    }
+};
+
+// One formula named through nameWithKernel
+struct KernelNamed {
+    string name;
+    MolecularProperties properties;
+    WorkBudget budget;
+    bool fromKernel = false;
+};
+
+// Names formulas[0, count), at most LANES of them: the ones the kernel takes
+// in one pass, the rest one by one through nameFormula under their own copy
+// of `limits`. Kernel-named molecules do no metered work (budget.steps 0).
+void nameWithKernel(SmallMoleculeKernel& kernel, const string* formulas, int count, const WorkBudget& limits,
+                    KernelNamed* results) {
+    int lanes[SmallMoleculeKernel::LANES];
+    bool ethers[SmallMoleculeKernel::LANES];
+    vector<MolecularGraph> molecules(count);
+    for (int i = 0; i < count; i++) {
+        results[i] = KernelNamed();
+        results[i].budget.maxSteps = limits.maxSteps;
+        results[i].budget.deadlineMs = limits.deadlineMs;
+        string f1, f2;
+        lanes[i] = -1;
+        ethers[i] = splitEther(formulas[i], f1, f2);
+        if (ethers[i]) continue;
+        molecules[i].parseMolecularFormula(formulas[i], &limits);
+        results[i].properties = molecules[i].properties;
+        lanes[i] = kernel.add(molecules[i]);
+    }
+    vector<string> names;
+    kernel.run(names);
+    for (int i = 0; i < count; i++) {
+        KernelNamed& result = results[i];
+        if (ethers[i]) {
+            result.name = nameFormula<NoTrace>(formulas[i], result.budget, &result.properties);
+            continue;
+        }
+        recordMolecule(formulas[i]);
+        if (lanes[i] >= 0 && !names[lanes[i]].empty()) {
+            result.name = names[lanes[i]];
+            result.fromKernel = true;
+            recordDecision(EVENT_KERNEL, 0, 0, 1);
+            recordDecision(EVENT_NAME, result.name.size(), stableHash(result.name));
+        } else {
+            if (lanes[i] >= 0) recordDecision(EVENT_KERNEL);
+            result.name = processMolecularGraph<NoTrace>(molecules[i], 0, result.budget);  // already parsed
+        }
+    }
+}
+
+// -------------------- Batch Mode --------------------
+
+string jsonEscape(const string& text) {
+    string result;
+    for (char ch : text) {
+        switch (ch) {
+            case '"': result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            case '\n': result += "\\n"; break;
+            case '\t': result += "\\t"; break;
+            case '\r': result += "\\r"; break;
+            default:
+                if ((unsigned char)ch < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+                    result += escaped;
+                } else {
+                    result += ch;
+                }
+        }
+    }
+    return result;
+}
+
+// Columns written by --batch --columns, in order
+const char* BATCH_COLUMNS = "formula\tname\tmolecular_formula\tmolecular_weight\tunsaturation\theavy_atoms\tstatus";
+
+// --batch: one formula per stdin line. Each gets its own copy of the work
+// budget. Output is one JSON object per line, or with --columns a
+// tab-separated table (header row first) for loading millions of rows.
+// One output row of batch mode, as JSON or as a tab-separated row
+void writeBatchRecord(ostream& out, bool columns, const string& formula, const string& name,
+                      const MolecularProperties& properties, const char* status, long long steps,
+                      const char* error = nullptr) {
+    if (columns) {
+        out << formula << "\t" << name << "\t" << properties.formula() << "\t" << properties.weight() << "\t"
+            << properties.unsaturation() << "\t" << properties.heavyAtoms() << "\t" << status << "\n";
+    } else {
+        out << "{\"formula\":\"" << jsonEscape(formula) << "\",\"name\":\"" << jsonEscape(name)
+            << "\",\"molecular_formula\":\"" << properties.formula() << "\",\"molecular_weight\":" << properties.weight()
+            << ",\"unsaturation\":" << properties.unsaturation() << ",\"heavy_atoms\":" << properties.heavyAtoms()
+            << ",\"status\":\"" << status << "\",\"steps\":" << steps;
+        if (error) out << ",\"error\":\"" << jsonEscape(error) << "\"";
+        out << "}\n";
+    }
+}
+
+// With `stream` every record is flushed as soon as it is written, for callers reading through a pipe.
+// With `kernel` (and neither a cache nor `stream`) formulas are read LANES at a time and named
+// through the small-molecule kernel.
+int runBatchMode(const WorkBudget& limits, bool columns, NameCache* cache = nullptr, bool stream = false,
+                 bool kernel = false) {
+    ostream& out = cout;
+    out.setf(ios::fixed);
+    out.precision(3);
+    if (columns) out << BATCH_COLUMNS << "\n";
+
+    string formula;
+    if (kernel && !cache && !stream) {
+        SmallMoleculeKernel smallMolecules;
+        vector<string> block;
+        vector<KernelNamed> results(SmallMoleculeKernel::LANES);
+        bool more = true;
+        while (more) {
+            block.clear();
+            while (block.size() < SmallMoleculeKernel::LANES && (more = (bool)getline(cin, formula))) {
+                if (!formula.empty()) block.push_back(formula);
+            }
+            nameWithKernel(smallMolecules, block.data(), block.size(), limits, results.data());
+            for (size_t i = 0; i < block.size(); i++) {
+                KernelNamed& result = results[i];
+                const char* status = result.budget.exceeded ? "budget_exceeded" : result.name.empty() ? "no_name" : "ok";
+                if (result.budget.exceeded) result.name.clear();
+                writeBatchRecord(out, columns, block[i], result.name, result.properties, status, result.budget.steps);
+            }
+        }
+        return 0;
+    }
+
+    while (getline(cin, formula)) {
+        if (formula.empty()) continue;
+
+        WorkBudget budget;
+        budget.maxSteps = limits.maxSteps;
+        budget.deadlineMs = limits.deadlineMs;
+        MolecularProperties properties;
+        string name = nameFormulaCached<NoTrace>(cache, formula, budget, &properties);
+        const char* status = budget.exceeded ? "budget_exceeded" : name.empty() ? "no_name" : "ok";
+        if (budget.exceeded) name.clear();
+
+        writeBatchRecord(out, columns, formula, name, properties, status, budget.steps);
+        if (stream) out.flush();
+    }
+    return 0;
+}
+
+// -------------------- Pipelined Batch Mode --------------------
+
+// Bounded lock-free queue for any number of producers and consumers
+// (Vyukov's design: every cell carries a sequence number telling producers
+// and consumers whose turn it is). The single-producer and single-consumer
+// ends of the pipeline use it as well; there the CAS is never contended.
+// Blocking push/pop spin, then yield, then sleep, and record how often and
+// how long they had to wait.
+template <class T>
+class BoundedQueue {
+public:
+    struct Stats {
+        atomic<long long> pushes{0}, pushStalls{0}, pushStallNs{0}, popStalls{0}, popStallNs{0};
+        atomic<long long> depthSum{0}, maxDepth{0};
+    };
+
+    Stats stats;
+
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+        cells = vector<Cell>(size);
+        for (size_t i = 0; i < size; i++) cells[i].sequence.store(i, memory_order_relaxed);
+        mask = size - 1;
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+    bool tryPush(const T& value) {
+        size_t position = tail.load(memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+            if (difference == 0) {
+                if (tail.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(position + 1, memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;  // full
+            } else {
+                position = tail.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(T& value) {
+        size_t position = head.load(memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+            if (difference == 0) {
+                if (head.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                    value = cell.value;
+                    cell.sequence.store(position + mask + 1, memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;  // empty
+            } else {
+                position = head.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    void push(const T& value) {
+        if (!tryPush(value)) {
+            stats.pushStalls++;
+            auto start = chrono::steady_clock::now();
+            for (int attempt = 0; !tryPush(value); attempt++) backOff(attempt);
+            stats.pushStallNs += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        }
+        long long depth = (long long)(tail.load(memory_order_relaxed) - head.load(memory_order_relaxed));
+        stats.pushes++;
+        stats.depthSum += depth;
+        long long deepest = stats.maxDepth.load(memory_order_relaxed);
+        while (depth > deepest && !stats.maxDepth.compare_exchange_weak(deepest, depth)) {}
+    }
+
+    // Blocks until an item arrives; false once the queue is closed and drained
+    bool pop(T& value) {
+        if (tryPop(value)) return true;
+        stats.popStalls++;
+        auto start = chrono::steady_clock::now();
+        bool popped = false;
+        for (int attempt = 0;; attempt++) {
+            bool wasClosed = closed.load(memory_order_acquire);
+            if (tryPop(value)) {
+                popped = true;
+                break;
+            }
+            if (wasClosed) break;
+            backOff(attempt);
+        }
+        stats.popStallNs += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        return popped;
+    }
+
+    // No more pushes; consumers drain what is left and stop
+    void close() { closed.store(true, memory_order_release); }
+
+    static void backOff(int attempt) {
+        if (attempt < 64) return;
+        if (attempt < 128) this_thread::yield();
+        else this_thread::sleep_for(chrono::microseconds(50));
+    }
+
+private:
+    struct Cell {
+        atomic<size_t> sequence;
+        T value;
+    };
+
+    vector<Cell> cells;
+    size_t mask = 0;
+    alignas(64) atomic<size_t> tail{0};
+    alignas(64) atomic<size_t> head{0};
+    alignas(64) atomic<bool> closed{false};
+};
+
+// One formula on its way through the pipeline
+struct PipelineRecord {
+    uint64_t sequence = 0;
+    string formula;
+    MolecularGraph molecule;
+    bool ether = false;
+    bool done = false;  // answered from the name cache
+    string name;
+    MolecularProperties properties;
+    const char* status = "";
+    long long steps = 0;
+};
+
+// Worker counts and queue sizes of the pipeline
+struct PipelineOptions {
+    int parseWorkers = 1;
+    int analyzeWorkers = 0;  // 0 = one per hardware thread
+    size_t queueDepth = 256;
+    bool stats = false;
+};
+
+// Busy time and item count of one stage
+struct StageStats {
+    const char* name;
+    int workers = 0;
+    atomic<long long> items{0}, busyNs{0};
+};
+
+template <class T>
+void printQueueStats(ostream& out, const char* name, BoundedQueue<T>& queue) {
+    auto& s = queue.stats;
+    long long pushes = s.pushes.load();
+    out << "\"" << name << "\":{\"capacity\":" << queue.capacity() << ",\"pushes\":" << pushes
+        << ",\"mean_depth\":" << (pushes ? (double)s.depthSum.load() / pushes : 0.0) << ",\"max_depth\":" << s.maxDepth.load()
+        << ",\"push_stalls\":" << s.pushStalls.load() << ",\"push_stall_ms\":" << s.pushStallNs.load() / 1e6
+        << ",\"pop_stalls\":" << s.popStalls.load() << ",\"pop_stall_ms\":" << s.popStallNs.load() / 1e6 << "}";
+}
+
+// --batch --pipeline: batch mode as four overlapping stages joined by
+// bounded queues, so reading, parsing, naming and writing run at the same
+// time:
+//   read     (1 thread)    splits stdin into records and numbers them
+//   parse    (N threads)   answers from the name cache or builds the graph
+//   analyze  (M threads)   picks the chain, names the branches and the molecule
+//   emit     (main thread) puts records back in input order and writes them
+// The reader keeps at most `window` records in flight, so the reorder
+// buffer is bounded even when one record takes long. Output is the same as
+// runBatchMode's. With `stats`, per-stage busy time and per-queue depth and
+// stall counts go to stderr as JSON when the input ends.
+int runPipelinedBatchMode(const WorkBudget& limits, bool columns, NameCache* cache, bool stream,
+                          PipelineOptions options) {
+    ostream& out = cout;
+    out.setf(ios::fixed);
+    out.precision(3);
+    if (columns) out << BATCH_COLUMNS << "\n";
+
+    int parseWorkers = max(1, options.parseWorkers);
+    int analyzeWorkers = options.analyzeWorkers > 0 ? options.analyzeWorkers : max(1u, thread::hardware_concurrency());
+    BoundedQueue<PipelineRecord*> records(options.queueDepth), parsed(options.queueDepth), named(options.queueDepth);
+    const uint64_t window = 4 * options.queueDepth + parseWorkers + analyzeWorkers;
+    atomic<uint64_t> emitted{0};
+    atomic<long long> windowStalls{0};
+    StageStats readStage{"read", 1}, parseStage{"parse", parseWorkers}, analyzeStage{"analyze", analyzeWorkers},
+        emitStage{"emit", 1};
+    auto since = [](chrono::steady_clock::time_point start) {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    };
+
+    thread reader([&] {
+        string formula;
+        uint64_t sequence = 0;
+        while (true) {
+            auto start = chrono::steady_clock::now();
+            if (!getline(cin, formula)) break;
+            if (formula.empty()) continue;
+            PipelineRecord* record = new PipelineRecord;
+            record->sequence = sequence++;
+            record->formula = move(formula);
+            readStage.busyNs += since(start);
+            readStage.items++;
+            if (record->sequence - emitted.load(memory_order_acquire) >= window) {
+                windowStalls++;
+                for (int attempt = 0; record->sequence - emitted.load(memory_order_acquire) >= window; attempt++) {
+                    BoundedQueue<PipelineRecord*>::backOff(attempt);
+                }
+            }
+            records.push(record);
+        }
+        records.close();
+    });
+
+    atomic<int> parsersLeft{parseWorkers}, analyzersLeft{analyzeWorkers};
+    vector<thread> workers;
+    for (int w = 0; w < parseWorkers; w++) {
+        workers.emplace_back([&] {
+            PipelineRecord* record;
+            while (records.pop(record)) {
+                auto start = chrono::steady_clock::now();
+                CachedName cached;
+                string f1, f2;
+                if (cache && cache->lookup(normalizedFormula(record->formula), cached)) {
+                    record->done = true;
+                    record->name = cached.name;
+                    record->properties = cached.properties;
+                    record->steps = cached.steps;
+                } else if (splitEther(record->formula, f1, f2)) {
+                    record->ether = true;  // named whole by the analyze stage
+                } else {
+                    record->molecule.parseMolecularFormula(record->formula, &limits);
+                    record->properties = record->molecule.properties;
+                }
+                parseStage.busyNs += since(start);
+                parseStage.items++;
+                parsed.push(record);
+            }
+            if (--parsersLeft == 0) parsed.close();
+        });
+    }
+    for (int w = 0; w < analyzeWorkers; w++) {
+        workers.emplace_back([&] {
+            PipelineRecord* record;
+            while (parsed.pop(record)) {
+                auto start = chrono::steady_clock::now();
+                bool exceeded = false;
+                if (!record->done) {
+                    WorkBudget budget;
+                    budget.maxSteps = limits.maxSteps;
+                    budget.deadlineMs = limits.deadlineMs;
+                    if (record->ether) {
+                        record->name = nameFormula<NoTrace>(record->formula, budget, &record->properties);
+                    } else {
+                        recordMolecule(record->formula);
+                        record->name = processMolecularGraph<NoTrace>(record->molecule, 0, budget);
+                    }
+                    record->steps = budget.steps;
+                    exceeded = budget.exceeded;
+                    if (exceeded) {
+                        record->name.clear();
+                    } else if (cache) {
+                        CachedName entry;
+                        entry.name = record->name;
+                        entry.properties = record->properties;
+                        entry.steps = budget.steps;
+                        cache->insert(normalizedFormula(record->formula), entry);
+                    }
+                    record->molecule = MolecularGraph();  // the graph is not needed past this stage
+                }
+                record->status = exceeded ? "budget_exceeded" : record->name.empty() ? "no_name" : "ok";
+                analyzeStage.busyNs += since(start);
+                analyzeStage.items++;
+                named.push(record);
+            }
+            if (--analyzersLeft == 0) named.close();
+        });
+    }
+
+    // Emit: a ring of `window` slots indexed by sequence holds records that arrived early
+    vector<PipelineRecord*> pending(window, nullptr);
+    uint64_t next = 0;
+    PipelineRecord* record;
+    while (named.pop(record)) {
+        pending[record->sequence % window] = record;
+        auto start = chrono::steady_clock::now();
+        while ((record = pending[next % window]) != nullptr && record->sequence == next) {
+            writeBatchRecord(out, columns, record->formula, record->name, record->properties, record->status, record->steps);
+            if (stream) out.flush();
+            pending[next % window] = nullptr;
+            delete record;
+            next++;
+            emitStage.items++;
+        }
+        emitted.store(next, memory_order_release);
+        emitStage.busyNs += since(start);
+    }
+    out.flush();
+    reader.join();
+    for (thread& worker : workers) worker.join();
+
+    if (options.stats) {
+        ostream& err = cerr;
+        err << "{\"pipeline\":{\"records\":" << next << ",\"window\":" << window << ",\"window_stalls\":" << windowStalls.load()
+            << ",\"stages\":{";
+        StageStats* stages[] = {&readStage, &parseStage, &analyzeStage, &emitStage};
+        for (int i = 0; i < 4; i++) {
+            err << (i ? "," : "") << "\"" << stages[i]->name << "\":{\"workers\":" << stages[i]->workers
+                << ",\"items\":" << stages[i]->items.load() << ",\"busy_ms\":" << stages[i]->busyNs.load() / 1e6 << "}";
+        }
+        err << "},\"queues\":{";
+        printQueueStats(err, "read_to_parse", records);
+        err << ",";
+        printQueueStats(err, "parse_to_analyze", parsed);
+        err << ",";
+        printQueueStats(err, "analyze_to_emit", named);
+        err << "}}}" << endl;
+    }
+    return 0;
+}
+
+// Properties printed after the name in interactive mode
+void printProperties(const MolecularProperties& properties) {
+    cout << "Molecular Formula: " << properties.formula() << endl;
+    ostringstream weight;
+    weight.setf(ios::fixed);
+    weight.precision(3);
+    weight << properties.weight();
+    cout << "Molecular Weight: " << weight.str() << endl;
+    cout << "Degree of Unsaturation: " << properties.unsaturation() << endl;
+    cout << "Heavy Atoms: " << properties.heavyAtoms() << endl;
+}
+
+// -------------------- Atom Graph --------------------
+
+// Heavy-atom view of a parsed molecule used by structure search: halogens
+// become atoms of their own, hydrogens stay implicit as a per-atom count.
+struct AtomGraph {
+    vector<AtomKind> kinds;  // ELEMENT_C, KIND_COOH, ELEMENT_CL, ...
+    vector<int> hydrogens;
+    vector<vector<int>> adj;
+    vector<int> source;  // parsed carbon id, 0 for halogen and ether atoms
+
+    int addAtom(AtomKind kind, int hydrogenCount) {
+        kinds.push_back(kind);
+        hydrogens.push_back(hydrogenCount);
+        source.push_back(0);
+        adj.emplace_back();
+        return kinds.size() - 1;
+    }
+
+    void addBond(int a, int b) {
+        adj[a].push_back(b);
+        adj[b].push_back(a);
+    }
+
+    int size() const { return kinds.size(); }
+
+    // Appends a parsed molecule; returns the atom index of parsed carbon `anchor` (0 for none).
+    // A (CH2)n run is written out as n atoms: bonds parsed before the run reach
+    // its first atom, bonds parsed after it leave from its last.
+    int append(const MolecularGraph& molecule, int anchor = 0) {
+        unordered_map<int, int> firstAtom, lastAtom;
+        for (int id = 1; id < molecule.counter; id++) {
+            AtomKind kind = molecule.kinds[id];
+            int hydrogenCount = molecule.hydrogens[id];
+            int atom = addAtom(kind, hydrogenCount);
+            source[atom] = id;
+            firstAtom[id] = atom;
+            for (int n = 1; n < molecule.run(id); n++) {
+                int next = addAtom(kind, hydrogenCount);
+                source[next] = id;
+                addBond(atom, next);
+                atom = next;
+            }
+            lastAtom[id] = atom;
+            for (int type = 1; type <= 4; type++) {
+                for (int x = 0; x < molecule.halogenCount(id, type); x++) addBond(atom, addAtom(HALOGEN_ELEMENTS[type], 0));
+            }
+        }
+        for (const auto& edge : molecule.edges) {
+            addBond(lastAtom[edge.first], firstAtom[edge.second]);
+        }
+        if (anchor <= 0 || !firstAtom.count(anchor)) return -1;
+        return anchor == 1 ? firstAtom[anchor] : lastAtom[anchor];
+    }
+};
+
+// Atom graph for a condensed formula; ethers are joined through an O atom
+AtomGraph buildAtomGraph(const string& formula) {
+    AtomGraph result;
+    string f1, f2;
+    if (splitEther(formula, f1, f2)) {
+        MolecularGraph g1, g2;
+        g1.parseMolecularFormula(f1);
+        g2.parseMolecularFormula(f2);
+        int left = result.append(g1, g1.counter - 1);
+        int right = result.append(g2, 1);
+        int oxygen = result.addAtom(ELEMENT_O, 0);
+        if (left >= 0) result.addBond(left, oxygen);
+        if (right >= 0) result.addBond(oxygen, right);
+        return result;
+    }
+    MolecularGraph molecule;
+    molecule.parseMolecularFormula(formula);
+    result.append(molecule);
+    return result;
+}
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() {
+        if (data) munmap((void*)data, size);
+    }
+
+    bool open(const string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) return false;
+        data = (const unsigned char*)mapped;
+        size = info.st_size;
+        return true;
+    }
+};
+
+// -------------------- Substructure Index --------------------
+
+// Longest path (in bonds) turned into an index key, and the longest one that
+// also carries degree bounds for its atoms
+const int INDEX_PATH_LENGTH = 4;
+const int INDEX_DEGREE_PATH_LENGTH = 2;
+
+// Screening keys of a graph. Every key of a substructure is also a key of
+// any molecule containing it:
+//   path keys   - element labels along each simple path of up to
+//                 INDEX_PATH_LENGTH bonds, read in the smaller direction
+//   degree keys - short paths whose atoms also carry a degree bound
+//                 (1, 2 or "3 or more"). A query emits its own degrees (one
+//                 more at the `anchor`, which has an open valence); a corpus
+//                 molecule emits every bound up to its real degree, since a
+//                 matched atom can only gain neighbours.
+vector<uint64_t> substructureKeys(const AtomGraph& g, bool isQuery = false, int anchor = -1) {
+    vector<uint64_t> keys;
+    vector<int> path;
+    vector<char> onPath(g.size(), 0);
+
+    auto degreeBound = [&](int atom) {
+        int degree = g.adj[atom].size() + (atom == anchor ? 1 : 0);
+        return min(degree, 3);
+    };
+
+    // Labels along the path with one chosen bound per atom
+    vector<int> bounds;
+    function<void(size_t)> emitBounded = [&](size_t k) {
+        if (k == path.size()) {
+            string forward, backward;
+            for (size_t i = 0; i < path.size(); i++) {
+                size_t j = path.size() - 1 - i;
+                forward += (i ? "-" : "") + string(atomSymbol(g.kinds[path[i]])) + to_string(bounds[i]);
+                backward += (i ? "-" : "") + string(atomSymbol(g.kinds[path[j]])) + to_string(bounds[j]);
+            }
+            keys.push_back(stableHash("b:" + min(forward, backward)));
+            return;
+        }
+        int top = degreeBound(path[k]);
+        for (int bound = isQuery ? top : 1; bound <= top; bound++) {
+            bounds[k] = bound;
+            emitBounded(k + 1);
+        }
+    };
+
+    function<void(int)> extend = [&](int atom) {
+        path.push_back(atom);
+        onPath[atom] = 1;
+
+        string forward, backward;
+        for (size_t i = 0; i < path.size(); i++) {
+            forward += (i ? "-" : "") + string(atomSymbol(g.kinds[path[i]]));
+            backward += (i ? "-" : "") + string(atomSymbol(g.kinds[path[path.size() - 1 - i]]));
+        }
+        keys.push_back(stableHash("p:" + min(forward, backward)));
+        if ((int)path.size() <= INDEX_DEGREE_PATH_LENGTH + 1 && degreeBound(path[0]) > 0) {
+            bounds.assign(path.size(), 0);
+            emitBounded(0);
+        }
+
+        if ((int)path.size() <= INDEX_PATH_LENGTH) {
+            for (int next : g.adj[atom]) {
+                if (!onPath[next]) extend(next);
+            }
+        }
+        onPath[atom] = 0;
+        path.pop_back();
+    };
+
+    for (int atom = 0; atom < g.size(); atom++) extend(atom);
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    return keys;
+}
+
+// Exact check that `query` occurs in `target`. Query atoms are matched in
+// BFS order, so each one after the first only has to be tried against the
+// neighbours of its already-placed parent. `anchor` is a query atom with an
+// open valence (the attachment point of a substituent name) whose target
+// atom must have a bond leading outside the match.
+bool containsSubgraph(const AtomGraph& target, const AtomGraph& query, int anchor) {
+    if (query.size() == 0) return true;
+    if (query.size() > target.size()) return false;
+
+    vector<int> order, parent(query.size(), -1);
+    vector<char> queued(query.size(), 0);
+    int start = anchor >= 0 ? anchor : 0;
+    order.push_back(start);
+    queued[start] = 1;
+    for (size_t head = 0; head < order.size(); head++) {
+        for (int next : query.adj[order[head]]) {
+            if (!queued[next]) {
+                queued[next] = 1;
+                parent[next] = order[head];
+                order.push_back(next);
+            }
+        }
+    }
+    if ((int)order.size() != query.size()) return false;  // query must be connected
+
+    vector<int> mapped(query.size(), -1);
+    vector<char> used(target.size(), 0);
+
+    auto compatible = [&](int q, int t) {
+        if (used[t] || target.kinds[t] != query.kinds[q]) return false;
+        size_t needed = query.adj[q].size() + (q == anchor ? 1 : 0);
+        if (target.adj[t].size() < needed) return false;
+        // Bonds to already-placed query atoms must exist in the target too
+        for (int qn : query.adj[q]) {
+            if (mapped[qn] >= 0 && find(target.adj[t].begin(), target.adj[t].end(), mapped[qn]) == target.adj[t].end()) return false;
+        }
+        return true;
+    };
+
+    function<bool(size_t)> place = [&](size_t k) {
+        if (k == order.size()) return true;
+        int q = order[k];
+        const vector<int>* candidates = nullptr;
+        vector<int> all;
+        if (parent[q] >= 0) {
+            candidates = &target.adj[mapped[parent[q]]];
+        } else {
+            for (int t = 0; t < target.size(); t++) all.push_back(t);
+            candidates = &all;
+        }
+        for (int t : *candidates) {
+            if (!compatible(q, t)) continue;
+            mapped[q] = t;
+            used[t] = 1;
+            if (place(k + 1)) return true;
+            used[t] = 0;
+            mapped[q] = -1;
+        }
+        return false;
+    };
+    return place(0);
+}
+
+void writeVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += (char)(value | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
+
+uint64_t readVarint(const unsigned char*& p) {
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        unsigned char byte = *p++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+}
+
+// On-disk layout (little-endian, every section 8-byte aligned):
+//   IndexHeader
+//   IndexKeyEntry[keyCount], sorted by key
+//   uint64_t formulaOffsets[moleculeCount + 1], relative to the formula blob
+//   posting blob: per key, delta-encoded molecule ids as LEB128 varints
+//   formula blob: the corpus formulas, back to back
+const char INDEX_MAGIC[8] = {'O', 'C', 'T', 'I', 'D', 'X', '\0', '\0'};
+const uint32_t INDEX_VERSION = 1;
+
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t moleculeCount;
+    uint64_t keyCount;
+    uint64_t postingsOffset;
+    uint64_t formulasOffset;
+};
+
+struct IndexKeyEntry {
+    uint64_t key;
+    uint64_t offset;  // into the posting blob
+    uint32_t bytes;
+    uint32_t count;
+};
+
+// --index-build CORPUS OUT: one formula per corpus line (a "formula<TAB>name"
+// line from --isomers or --batch --columns works too)
+int runIndexBuildMode(const string& corpusPath, const string& indexPath) {
+    ifstream corpus(corpusPath);
+    if (!corpus) {
+        cerr << "Cannot open corpus: " << corpusPath << endl;
+        return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    map<uint64_t, vector<uint32_t>> postings;
+    string formulas;
+    vector<uint64_t> formulaOffsets = {0};
+    string line;
+    uint32_t molecule = 0;
+    while (getline(corpus, line)) {
+        string formula = line.substr(0, line.find('\t'));
+        if (formula.empty() || formula == "formula") continue;
+        for (uint64_t key : substructureKeys(buildAtomGraph(formula))) {
+            postings[key].push_back(molecule);
+        }
+        formulas += formula;
+        formulaOffsets.push_back(formulas.size());
+        molecule++;
+    }
+
+    vector<IndexKeyEntry> entries;
+    string blob;
+    for (const auto& posting : postings) {
+        IndexKeyEntry entry = {posting.first, blob.size(), 0, (uint32_t)posting.second.size()};
+        uint32_t previous = 0;
+        for (uint32_t id : posting.second) {
+            writeVarint(blob, id - previous);
+            previous = id;
+        }
+        entry.bytes = blob.size() - entry.offset;
+        entries.push_back(entry);
+    }
+    while (blob.size() % 8) blob += '\0';
+
+    IndexHeader header = {};
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.moleculeCount = molecule;
+    header.keyCount = entries.size();
+    header.postingsOffset = sizeof(IndexHeader) + entries.size() * sizeof(IndexKeyEntry) + formulaOffsets.size() * sizeof(uint64_t);
+    header.formulasOffset = header.postingsOffset + blob.size();
+
+    ofstream out(indexPath, ios::binary);
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)entries.data(), entries.size() * sizeof(IndexKeyEntry));
+    out.write((const char*)formulaOffsets.data(), formulaOffsets.size() * sizeof(uint64_t));
+    out.write(blob.data(), blob.size());
+    out.write(formulas.data(), formulas.size());
+    if (!out) {
+        cerr << "Cannot write index: " << indexPath << endl;
+        return 1;
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << "molecules=" << molecule << " keys=" << entries.size() << " posting_bytes=" << blob.size()
+         << " seconds=" << seconds << endl;
+    return 0;
+}
+
+// Read-only view of an index file mapped into memory
+class SubstructureIndex {
+public:
+    bool open(const string& path) {
+        if (!file.open(path) || file.size < sizeof(IndexHeader)) return false;
+        base = file.data;
+
+        header = (const IndexHeader*)base;
+        if (memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || header->version != INDEX_VERSION) return false;
+        entries = (const IndexKeyEntry*)(base + sizeof(IndexHeader));
+        formulaOffsets = (const uint64_t*)(entries + header->keyCount);
+        return true;
+    }
+
+    uint32_t moleculeCount() const { return header->moleculeCount; }
+
+    string formula(uint32_t molecule) const {
+        const char* blob = (const char*)base + header->formulasOffset;
+        return string(blob + formulaOffsets[molecule], formulaOffsets[molecule + 1] - formulaOffsets[molecule]);
+    }
+
+    const IndexKeyEntry* find(uint64_t key) const {
+        const IndexKeyEntry* end = entries + header->keyCount;
+        const IndexKeyEntry* it = lower_bound(entries, end, key,
+            [](const IndexKeyEntry& entry, uint64_t k) { return entry.key < k; });
+        return it != end && it->key == key ? it : nullptr;
+    }
+
+    // Molecules whose posting lists contain every key, shortest list first
+    vector<uint32_t> candidates(const vector<uint64_t>& keys) const {
+        vector<const IndexKeyEntry*> lists;
+        for (uint64_t key : keys) {
+            const IndexKeyEntry* entry = find(key);
+            if (!entry) return {};
+            lists.push_back(entry);
+        }
+        if (lists.empty()) {
+            vector<uint32_t> all(moleculeCount());
+            for (uint32_t i = 0; i < all.size(); i++) all[i] = i;
+            return all;
+        }
+        sort(lists.begin(), lists.end(), [](const IndexKeyEntry* a, const IndexKeyEntry* b) { return a->count < b->count; });
+
+        vector<uint32_t> result = decode(*lists[0]);
+        for (size_t i = 1; i < lists.size() && !result.empty(); i++) {
+            // Merge-intersect against the next list while decoding it
+            const unsigned char* p = base + header->postingsOffset + lists[i]->offset;
+            uint32_t id = 0, remaining = lists[i]->count;
+            size_t kept = 0, r = 0;
+            if (remaining > 0) { id = readVarint(p); remaining--; }
+            bool more = lists[i]->count > 0;
+            while (r < result.size() && more) {
+                if (result[r] < id) {
+                    r++;
+                } else {
+                    if (result[r] == id) result[kept++] = result[r++];
+                    if (remaining == 0) more = false;
+                    else { id += readVarint(p); remaining--; }
+                }
+            }
+            result.resize(kept);
+        }
+        return result;
+    }
+
+private:
+    MappedFile file;
+    const unsigned char* base = nullptr;
+    const IndexHeader* header = nullptr;
+    const IndexKeyEntry* entries = nullptr;
+    const uint64_t* formulaOffsets = nullptr;
+
+    vector<uint32_t> decode(const IndexKeyEntry& entry) const {
+        vector<uint32_t> ids(entry.count);
+        const unsigned char* p = base + header->postingsOffset + entry.offset;
+        uint32_t id = 0;
+        for (uint32_t i = 0; i < entry.count; i++) {
+            id += readVarint(p);
+            ids[i] = id;
+        }
+        return ids;
+    }
+};
+
+// Query graph for a substituent name ("2-methylbutyl"), a full name or a
+// condensed formula; `anchor` is set to the attachment atom of a substituent.
+bool buildQueryGraph(const NameTrie& trie, const string& query, AtomGraph& graph, int& anchor) {
+    anchor = -1;
+    NameParser substituent(trie, query);
+    if (substituent.parse(true)) {
+        StructureBuilder builder(substituent.chains, false, 1);
+        anchor = graph.append(builder.graph, 1);
+        return true;
+    }
+    string formula, error;
+    if (reverseName(trie, query, formula, error)) {
+        graph = buildAtomGraph(formula);
+        return true;
+    }
+    if (query.find_first_of("CH") == string::npos) return false;
+    graph = buildAtomGraph(query);
+    return graph.size() > 0;
+}
+
+// --index-query INDEX: one query per stdin line; prints the matching corpus
+// formulas under a "# query" line and per-query timings on stderr
+int runIndexQueryMode(const string& indexPath) {
+    SubstructureIndex index;
+    if (!index.open(indexPath)) {
+        cerr << "Cannot open index: " << indexPath << endl;
+        return 1;
+    }
+
+    NameTrie trie;
+    ostream& out = cout;
+    string query;
+    while (getline(cin, query)) {
+        if (query.empty()) continue;
+        auto start = chrono::steady_clock::now();
+
+        AtomGraph fragment;
+        int anchor;
+        if (!buildQueryGraph(trie, query, fragment, anchor)) {
+            out << "# " << query << "\tERROR: not a substituent name, name or formula\n";
+            continue;
+        }
+
+        vector<uint32_t> candidates = index.candidates(substructureKeys(fragment, true, anchor));
+        vector<uint32_t> matches;
+        for (uint32_t molecule : candidates) {
+            if (containsSubgraph(buildAtomGraph(index.formula(molecule)), fragment, anchor)) matches.push_back(molecule);
+        }
+
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        out << "# " << query << "\t" << matches.size() << " matches\n";
+        for (uint32_t molecule : matches) out << index.formula(molecule) << "\n";
+        cerr << "query=" << query << " molecules=" << index.moleculeCount() << " candidates=" << candidates.size()
+             << " matches=" << matches.size() << " ms=" << ms << endl;
+    }
+    return 0;
+}
+
+// -------------------- Fingerprint Similarity --------------------
+
+// Longest bond path hashed into a fingerprint by default
+const int FINGERPRINT_PATH_LENGTH = 5;
+
+// Fixed-width path fingerprint: every simple path of up to `pathLength`
+// bonds, written as element+H-count labels in its smaller direction
+// (e.g. "C3-C2-Cl0"), is hashed to one bit. `bits` is 1024 or 2048.
+void pathFingerprint(const AtomGraph& g, int bits, int pathLength, uint64_t* words) {
+    fill(words, words + bits / 64, 0);
+    vector<string> atomLabels(g.size());
+    for (int atom = 0; atom < g.size(); atom++) {
+        atomLabels[atom] = atomSymbol(g.kinds[atom]) + to_string(g.hydrogens[atom]);
+    }
+
+    vector<int> path;
+    vector<char> onPath(g.size(), 0);
+    function<void(int)> extend = [&](int atom) {
+        path.push_back(atom);
+        onPath[atom] = 1;
+
+        string forward, backward;
+        for (size_t i = 0; i < path.size(); i++) {
+            forward += (i ? "-" : "") + atomLabels[path[i]];
+            backward += (i ? "-" : "") + atomLabels[path[path.size() - 1 - i]];
+        }
+        uint64_t bit = stableHash(min(forward, backward)) % bits;
+        words[bit / 64] |= 1ULL << (bit % 64);
+
+        if ((int)path.size() <= pathLength) {
+            for (int next : g.adj[atom]) {
+                if (!onPath[next]) extend(next);
+            }
+        }
+        onPath[atom] = 0;
+        path.pop_back();
+    };
+    for (int atom = 0; atom < g.size(); atom++) extend(atom);
+}
+
+// popcount(a & b) over `Words` 64-bit words. Uses AVX-512 VPOPCNTDQ or the
+// AVX2 nibble-lookup popcount when the build targets them, otherwise the
+// POPCNT instruction through __builtin_popcountll (build with -march=native).
+template <int Words>
+inline int intersectionCount(const uint64_t* a, const uint64_t* b) {
+#if defined(__AVX512VPOPCNTDQ__) && defined(__AVX512F__)
+    __m512i total = _mm512_setzero_si512();
+    for (int i = 0; i < Words; i += 8) {
+        __m512i both = _mm512_and_si512(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        total = _mm512_add_epi64(total, _mm512_popcnt_epi64(both));
+    }
+    alignas(64) uint64_t lanes[8];
+    _mm512_store_si512(lanes, total);
+    return (int)(lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7]);
+#elif defined(__AVX2__)
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i total = _mm256_setzero_si256();
+    for (int i = 0; i < Words; i += 4) {
+        __m256i both = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(a + i)),
+                                        _mm256_loadu_si256((const __m256i*)(b + i)));
+        __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, _mm256_and_si256(both, low)),
+                                         _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(both, 4), low)));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(counts, _mm256_setzero_si256()));
+    }
+    return (int)(_mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+                 _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3));
+#else
+    int total = 0;
+    for (int i = 0; i < Words; i++) total += __builtin_popcountll(a[i] & b[i]);
+    return total;
+#endif
+}
+
+int popcount(const uint64_t* words, int count) {
+    int total = 0;
+    for (int i = 0; i < count; i++) total += __builtin_popcountll(words[i]);
+    return total;
+}
+
+// On-disk layout: FingerprintHeader, then uint32_t popcounts[count] and
+// uint64_t formulaOffsets[count + 1], then the fingerprints (bits/64 words
+// each, 64-byte aligned) and finally the formula blob.
+const char FINGERPRINT_MAGIC[8] = {'O', 'C', 'T', 'F', 'P', '\0', '\0', '\0'};
+const uint32_t FINGERPRINT_VERSION = 1;
+
+struct FingerprintHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t bits;
+    uint32_t pathLength;
+    uint32_t count;
+    uint64_t popcountsOffset;
+    uint64_t formulaOffsetsOffset;
+    uint64_t fingerprintsOffset;
+    uint64_t formulasOffset;
+};
+
+// --fp-build CORPUS OUT [--bits 1024|2048] [--path-length K]
+int runFingerprintBuildMode(const string& corpusPath, const string& outPath, int bits, int pathLength) {
+    if (bits != 1024 && bits != 2048) {
+        cerr << "Fingerprint width must be 1024 or 2048 bits" << endl;
+        return 1;
+    }
+    ifstream corpus(corpusPath);
+    if (!corpus) {
+        cerr << "Cannot open corpus: " << corpusPath << endl;
+        return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    int words = bits / 64;
+    vector<uint64_t> fingerprints;
+    vector<uint32_t> popcounts;
+    vector<uint64_t> formulaOffsets = {0};
+    string formulas, line;
+    while (getline(corpus, line)) {
+        string formula = line.substr(0, line.find('\t'));
+        if (formula.empty() || formula == "formula") continue;
+        fingerprints.resize(fingerprints.size() + words);
+        uint64_t* fp = fingerprints.data() + fingerprints.size() - words;
+        pathFingerprint(buildAtomGraph(formula), bits, pathLength, fp);
+        popcounts.push_back(popcount(fp, words));
+        formulas += formula;
+        formulaOffsets.push_back(formulas.size());
+    }
+
+    auto align = [](uint64_t offset) { return (offset + 63) / 64 * 64; };
+    FingerprintHeader header = {};
+    memcpy(header.magic, FINGERPRINT_MAGIC, sizeof(FINGERPRINT_MAGIC));
+    header.version = FINGERPRINT_VERSION;
+    header.bits = bits;
+    header.pathLength = pathLength;
+    header.count = popcounts.size();
+    header.popcountsOffset = sizeof(FingerprintHeader);
+    header.formulaOffsetsOffset = align(header.popcountsOffset + popcounts.size() * sizeof(uint32_t));
+    header.fingerprintsOffset = align(header.formulaOffsetsOffset + formulaOffsets.size() * sizeof(uint64_t));
+    header.formulasOffset = header.fingerprintsOffset + fingerprints.size() * sizeof(uint64_t);
+
+    ofstream out(outPath, ios::binary);
+    auto padTo = [&](uint64_t offset) {
+        while ((uint64_t)out.tellp() < offset) out.put('\0');
+    };
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)popcounts.data(), popcounts.size() * sizeof(uint32_t));
+    padTo(header.formulaOffsetsOffset);
+    out.write((const char*)formulaOffsets.data(), formulaOffsets.size() * sizeof(uint64_t));
+    padTo(header.fingerprintsOffset);
+    out.write((const char*)fingerprints.data(), fingerprints.size() * sizeof(uint64_t));
+    out.write(formulas.data(), formulas.size());
+    if (!out) {
+        cerr << "Cannot write fingerprints: " << outPath << endl;
+        return 1;
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << "fingerprints=" << header.count << " bits=" << bits << " seconds=" << seconds << endl;
+    return 0;
+}
+
+// One hit of a similarity search
+struct SimilarityHit {
+    double score;
+    uint32_t molecule;
+    bool operator<(const SimilarityHit& other) const {
+        return score != other.score ? score > other.score : molecule < other.molecule;
+    }
+};
+
+// Scores every query against fingerprints [begin, end), keeping a top-k
+// min-heap per query. The database is walked in blocks so a block stays in
+// cache while all queries are scored against it.
+template <int Words>
+void scoreFingerprintRange(const uint64_t* database, const uint32_t* popcounts, uint32_t begin, uint32_t end,
+                           const vector<vector<uint64_t>>& queries, const vector<int>& queryPopcounts,
+                           int topK, vector<vector<SimilarityHit>>& heaps) {
+    const uint32_t BLOCK = 2048;
+    for (uint32_t blockStart = begin; blockStart < end; blockStart += BLOCK) {
+        uint32_t blockEnd = min(end, blockStart + BLOCK);
+        for (size_t q = 0; q < queries.size(); q++) {
+            const uint64_t* query = queries[q].data();
+            vector<SimilarityHit>& heap = heaps[q];
+            for (uint32_t m = blockStart; m < blockEnd; m++) {
+                int common = intersectionCount<Words>(query, database + (size_t)m * Words);
+                int either = queryPopcounts[q] + popcounts[m] - common;
+                double score = either > 0 ? (double)common / either : 1.0;
+                if ((int)heap.size() < topK) {
+                    heap.push_back({score, m});
+                    push_heap(heap.begin(), heap.end());
+                } else if (SimilarityHit{score, m} < heap.front()) {
+                    pop_heap(heap.begin(), heap.end());
+                    heap.back() = {score, m};
+                    push_heap(heap.begin(), heap.end());
+                }
+            }
+        }
+    }
+}
+
+// --fp-search FILE [--top K] [--threads T]: reads queries (formulas or
+// names) from stdin and prints the K most similar fingerprints by Tanimoto
+// score. Threads split the database; comparisons/s goes to stderr.
+int runFingerprintSearchMode(const string& path, int topK, int threadCount) {
+    MappedFile file;
+    if (!file.open(path) || file.size < sizeof(FingerprintHeader)) {
+        cerr << "Cannot open fingerprints: " << path << endl;
+        return 1;
+    }
+    const FingerprintHeader* header = (const FingerprintHeader*)file.data;
+    if (memcmp(header->magic, FINGERPRINT_MAGIC, sizeof(FINGERPRINT_MAGIC)) != 0 || header->version != FINGERPRINT_VERSION) {
+        cerr << "Not a fingerprint file: " << path << endl;
+        return 1;
+    }
+    const uint32_t* popcounts = (const uint32_t*)(file.data + header->popcountsOffset);
+    const uint64_t* formulaOffsets = (const uint64_t*)(file.data + header->formulaOffsetsOffset);
+    const uint64_t* database = (const uint64_t*)(file.data + header->fingerprintsOffset);
+    const char* formulas = (const char*)(file.data + header->formulasOffset);
+    int words = header->bits / 64;
+    if (topK < 1) topK = 1;
+    if (threadCount < 1) threadCount = max(1u, thread::hardware_concurrency());
+
+    NameTrie trie;
+    ostream& out = cout;
+
+    vector<string> queryText;
+    vector<vector<uint64_t>> queries;
+    vector<int> queryPopcounts;
+    string line;
+    while (getline(cin, line)) {
+        if (line.empty()) continue;
+        string formula = line, error;
+        if (!reverseName(trie, line, formula, error)) formula = line;
+        queries.emplace_back(words);
+        pathFingerprint(buildAtomGraph(formula), header->bits, header->pathLength, queries.back().data());
+        queryPopcounts.push_back(popcount(queries.back().data(), words));
+        queryText.push_back(line);
+    }
+
+    auto start = chrono::steady_clock::now();
+    vector<vector<vector<SimilarityHit>>> threadHeaps(threadCount, vector<vector<SimilarityHit>>(queries.size()));
+    vector<thread> workers;
+    uint32_t chunk = (header->count + threadCount - 1) / threadCount;
+    for (int w = 0; w < threadCount; w++) {
+        uint32_t begin = min<uint64_t>(header->count, (uint64_t)w * chunk);
+        uint32_t end = min<uint64_t>(header->count, (uint64_t)begin + chunk);
+        workers.emplace_back([&, w, begin, end]() {
+            if (words == 16) scoreFingerprintRange<16>(database, popcounts, begin, end, queries, queryPopcounts, topK, threadHeaps[w]);
+            else scoreFingerprintRange<32>(database, popcounts, begin, end, queries, queryPopcounts, topK, threadHeaps[w]);
+        });
+    }
+    for (thread& worker : workers) worker.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    for (size_t q = 0; q < queries.size(); q++) {
+        vector<SimilarityHit> hits;
+        for (const auto& heaps : threadHeaps) hits.insert(hits.end(), heaps[q].begin(), heaps[q].end());
+        sort(hits.begin(), hits.end());
+        if ((int)hits.size() > topK) hits.resize(topK);
+
+        out << "# " << queryText[q] << "\n";
+        for (const SimilarityHit& hit : hits) {
+            string formula(formulas + formulaOffsets[hit.molecule], formulaOffsets[hit.molecule + 1] - formulaOffsets[hit.molecule]);
+            out << hit.score << "\t" << formula << "\n";
+        }
+    }
+
+    double comparisons = (double)queries.size() * header->count;
+    cerr << "queries=" << queries.size() << " fingerprints=" << header->count << " threads=" << threadCount
+         << " seconds=" << seconds << " comparisons_per_s=" << (seconds > 0 ? comparisons / seconds : 0) << endl;
+    return 0;
+}
+
+// -------------------- Compiled Molecules --------------------
+
+// A compiled file holds finished parses so later runs can skip parsing and
+// the chain search. Layout: CompiledFileHeader, the records back to back
+// (each 8-byte aligned), then uint64_t recordOffsets[count + 1]. The offset
+// table is written last so the compiler can stream millions of records.
+//
+// Record: CompiledRecord, CompiledAtom atoms[atomCount],
+// uint32_t adjacencyOffsets[atomCount + 1], uint32_t neighbors[neighborCount],
+// uint32_t chain[chainLength] (atom indices, locant order),
+// CompiledSubstituent substituents[substituentCount], then the characters of
+// the formula, the name and the substituent prefixes.
+const char COMPILED_MAGIC[8] = {'O', 'C', 'T', 'M', 'O', 'L', '\0', '\0'};
+const uint32_t COMPILED_VERSION = 1;
+
+enum CompiledStatus : uint32_t { COMPILED_OK, COMPILED_NO_NAME, COMPILED_BUDGET_EXCEEDED };
+const char* COMPILED_STATUS_NAMES[] = {"ok", "no_name", "budget_exceeded"};
+
+// CompiledAtom::element for labels that are not an element symbol
+const uint8_t COMPILED_UNKNOWN_ELEMENT = 0xff;
+const uint8_t ATOM_CARBOXYL = 1;
+const uint8_t ATOM_FORMYL = 2;
+const uint8_t ATOM_NITRILE = 4;
+const uint8_t ATOM_ESTER = 8;
+
+// Group atoms are stored as their carbon plus one of these flags (0 for plain atoms)
+uint8_t compiledGroupFlag(AtomKind kind) {
+    switch (kind) {
+        case KIND_COOH: return ATOM_CARBOXYL;
+        case KIND_CHO: return ATOM_FORMYL;
+        case KIND_CN: return ATOM_NITRILE;
+        case KIND_ESTER: return ATOM_ESTER;
+        default: return 0;
+    }
+}
+
+struct CompiledFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t recordOffsetsOffset;
+};
+
+struct CompiledRecord {
+    uint32_t atomCount;
+    uint32_t neighborCount;
+    uint32_t chainLength;
+    uint32_t substituentCount;
+    uint32_t formulaLength;
+    uint32_t nameLength;
+    uint32_t status;
+    uint32_t steps;
+    uint32_t elementCounts[ELEMENT_COUNT];
+};
+
+struct CompiledAtom {
+    uint8_t element;
+    uint8_t hydrogens;
+    uint8_t degree;
+    uint8_t flags;
+};
+
+struct CompiledSubstituent {
+    uint32_t locant;
+    uint32_t prefixOffset;  // into the record's character area
+    uint32_t prefixLength;
+};
+
+// Read-only view of one record inside the mapped file; nothing is copied
+struct CompiledMolecule {
+    const CompiledRecord* record;
+
+    const CompiledAtom* atoms() const { return (const CompiledAtom*)(record + 1); }
+    const uint32_t* adjacencyOffsets() const { return (const uint32_t*)(atoms() + record->atomCount); }
+    const uint32_t* neighbors() const { return adjacencyOffsets() + record->atomCount + 1; }
+    const uint32_t* chain() const { return neighbors() + record->neighborCount; }
+    const CompiledSubstituent* substituents() const { return (const CompiledSubstituent*)(chain() + record->chainLength); }
+    const char* text() const { return (const char*)(substituents() + record->substituentCount); }
+
+    string formula() const { return string(text(), record->formulaLength); }
+    string name() const { return string(text() + record->formulaLength, record->nameLength); }
+    string prefix(const CompiledSubstituent& s) const { return string(text() + s.prefixOffset, s.prefixLength); }
+
+    MolecularProperties properties() const {
+        MolecularProperties result;
+        for (int e = 0; e < ELEMENT_COUNT; e++) result.counts[e] = record->elementCounts[e];
+        return result;
+    }
+};
+
+class CompiledMoleculeFile {
+public:
+    bool open(const string& path) {
+        if (!file.open(path) || file.size < sizeof(CompiledFileHeader)) return false;
+        header = (const CompiledFileHeader*)file.data;
+        if (memcmp(header->magic, COMPILED_MAGIC, sizeof(COMPILED_MAGIC)) != 0 || header->version != COMPILED_VERSION ||
+            header->recordOffsetsOffset + (header->count + 1) * sizeof(uint64_t) > file.size) {
+            return false;
+        }
+        offsets = (const uint64_t*)(file.data + header->recordOffsetsOffset);
+        return true;
+    }
+
+    size_t size() const { return header->count; }
+    CompiledMolecule operator[](size_t i) const { return {(const CompiledRecord*)(file.data + offsets[i])}; }
+
+private:
+    MappedFile file;
+    const CompiledFileHeader* header = nullptr;
+    const uint64_t* offsets = nullptr;
+};
+
+// True if `path` starts with the compiled-molecule magic
+bool isCompiledMoleculeFile(const string& path) {
+    ifstream in(path, ios::binary);
+    char magic[8] = {};
+    in.read(magic, sizeof(magic));
+    return in && memcmp(magic, COMPILED_MAGIC, sizeof(COMPILED_MAGIC)) == 0;
+}
+
+// Serializes one named formula into `buffer` as a CompiledRecord
+void appendCompiledRecord(string& buffer, const string& formula, const string& name, CompiledStatus status,
+                          long long steps, const MolecularProperties& properties, const ChainResult& result) {
+    AtomGraph g = buildAtomGraph(formula);
+    unordered_map<int, vector<uint32_t>> atomsOfCarbon;  // several for a (CH2)n run
+    for (int atom = 0; atom < g.size(); atom++) {
+        if (g.source[atom] > 0) atomsOfCarbon[g.source[atom]].push_back(atom);
+    }
+
+    CompiledRecord record = {};
+    record.atomCount = g.size();
+    record.status = status;
+    record.steps = (uint32_t)min<long long>(steps, UINT32_MAX);
+    for (int e = 0; e < ELEMENT_COUNT; e++) record.elementCounts[e] = properties.counts[e];
+
+    vector<CompiledAtom> atoms;
+    vector<uint32_t> adjacencyOffsets = {0}, neighbors, chain;
+    for (int atom = 0; atom < g.size(); atom++) {
+        CompiledAtom compiled = {COMPILED_UNKNOWN_ELEMENT, (uint8_t)g.hydrogens[atom], (uint8_t)g.adj[atom].size(), 0};
+        uint8_t groupFlag = compiledGroupFlag(g.kinds[atom]);
+        if (groupFlag) {
+            compiled.element = ELEMENT_C;
+            compiled.flags |= groupFlag;
+        } else if (g.kinds[atom] < ELEMENT_COUNT) {
+            compiled.element = g.kinds[atom];
+        }
+        atoms.push_back(compiled);
+        neighbors.insert(neighbors.end(), g.adj[atom].begin(), g.adj[atom].end());
+        adjacencyOffsets.push_back(neighbors.size());
+    }
+    for (int carbon : result.chain) {
+        vector<uint32_t> atoms = atomsOfCarbon[carbon];
+        if (atoms.empty()) atoms.push_back(UINT32_MAX);
+        // A run is entered from whichever end touches the previous chain atom
+        if (atoms.size() > 1 && !chain.empty() &&
+            find(g.adj[atoms.front()].begin(), g.adj[atoms.front()].end(), (int)chain.back()) == g.adj[atoms.front()].end()) {
+            reverse(atoms.begin(), atoms.end());
+        }
+        chain.insert(chain.end(), atoms.begin(), atoms.end());
+    }
+    record.neighborCount = neighbors.size();
+    record.chainLength = chain.size();
+
+    string text = formula + name;
+    vector<CompiledSubstituent> substituents;
+    for (const auto& substituent : result.substituents) {
+        substituents.push_back({(uint32_t)substituent.first, (uint32_t)text.size(), (uint32_t)substituent.second.size()});
+        text += substituent.second;
+    }
+    record.substituentCount = substituents.size();
+    record.formulaLength = formula.size();
+    record.nameLength = name.size();
+
+    auto append = [&](const void* data, size_t bytes) { buffer.append((const char*)data, bytes); };
+    append(&record, sizeof(record));
+    append(atoms.data(), atoms.size() * sizeof(CompiledAtom));
+    append(adjacencyOffsets.data(), adjacencyOffsets.size() * sizeof(uint32_t));
+    append(neighbors.data(), neighbors.size() * sizeof(uint32_t));
+    append(chain.data(), chain.size() * sizeof(uint32_t));
+    append(substituents.data(), substituents.size() * sizeof(CompiledSubstituent));
+    append(text.data(), text.size());
+    buffer.resize((buffer.size() + 7) / 8 * 8, '\0');
+}
+
+// --compile CORPUS OUT: names every formula in CORPUS and writes the results
+// in the compiled format. Budget flags apply per formula.
+int runCompileMode(const string& corpusPath, const string& outPath, const WorkBudget& limits) {
+    ifstream corpus(corpusPath);
+    if (!corpus) {
+        cerr << "Cannot open corpus: " << corpusPath << endl;
+        return 1;
+    }
+    ofstream out(outPath, ios::binary);
+    auto start = chrono::steady_clock::now();
+
+    CompiledFileHeader header = {};
+    memcpy(header.magic, COMPILED_MAGIC, sizeof(COMPILED_MAGIC));
+    header.version = COMPILED_VERSION;
+    out.write((const char*)&header, sizeof(header));
+
+    vector<uint64_t> offsets = {sizeof(header)};
+    string record, line;
+    while (getline(corpus, line)) {
+        string formula = line.substr(0, line.find('\t'));
+        if (formula.empty() || formula == "formula") continue;
+
+        WorkBudget budget;
+        budget.maxSteps = limits.maxSteps;
+        budget.deadlineMs = limits.deadlineMs;
+        MolecularProperties properties;
+        ChainResult result;
+        string name = nameFormula<NoTrace>(formula, budget, &properties, &result);
+        CompiledStatus status = budget.exceeded ? COMPILED_BUDGET_EXCEEDED : name.empty() ? COMPILED_NO_NAME : COMPILED_OK;
+        if (budget.exceeded) {
+            name.clear();
+            result = ChainResult();
+        }
+
+        record.clear();
+        appendCompiledRecord(record, formula, name, status, budget.steps, properties, result);
+        out.write(record.data(), record.size());
+        offsets.push_back(offsets.back() + record.size());
+    }
+
+    header.count = offsets.size() - 1;
+    header.recordOffsetsOffset = offsets.back();
+    out.write((const char*)offsets.data(), offsets.size() * sizeof(uint64_t));
+    out.seekp(0);
+    out.write((const char*)&header, sizeof(header));
+    if (!out) {
+        cerr << "Cannot write compiled molecules: " << outPath << endl;
+        return 1;
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << "molecules=" << header.count << " bytes=" << offsets.back() + offsets.size() * sizeof(uint64_t)
+         << " seconds=" << seconds << endl;
+    return 0;
+}
+
+// --batch --input FILE with a compiled file: records are streamed straight out
+// of the mapping; only records that ran out of budget when compiled are named again.
+int runCompiledBatchMode(const string& path, const WorkBudget& limits, bool columns) {
+    CompiledMoleculeFile molecules;
+    if (!molecules.open(path)) {
+        cerr << "Not a compiled molecule file: " << path << endl;
+        return 1;
+    }
+    ostream& out = cout;
+    out.setf(ios::fixed);
+    out.precision(3);
+    if (columns) out << BATCH_COLUMNS << "\n";
+
+    for (size_t i = 0; i < molecules.size(); i++) {
+        CompiledMolecule molecule = molecules[i];
+        string formula = molecule.formula();
+        if (molecule.record->status != COMPILED_BUDGET_EXCEEDED) {
+            writeBatchRecord(out, columns, formula, molecule.name(), molecule.properties(),
+                             COMPILED_STATUS_NAMES[molecule.record->status], molecule.record->steps);
+            continue;
+        }
+
+        WorkBudget budget;
+        budget.maxSteps = limits.maxSteps;
+        budget.deadlineMs = limits.deadlineMs;
+        string name = nameFormula<NoTrace>(formula, budget);
+        const char* status = budget.exceeded ? "budget_exceeded" : name.empty() ? "no_name" : "ok";
+        if (budget.exceeded) name.clear();
+        writeBatchRecord(out, columns, formula, name, molecule.properties(), status, budget.steps);
+    }
+    return 0;
+}
+
+// -------------------- Sharded Batch Mode --------------------
+
+// --batch --input FILE --shards N [--shard-dir DIR]: names FILE in N worker
+// processes, so one bad input or a fragmented heap only costs one shard.
+// Shard k covers bytes [k * size / N, (k + 1) * size / N) of FILE, both
+// ends moved forward to the start of a line. Each worker writes its records
+// to DIR/shard-k.out and, every SHARD_CHECKPOINT_RECORDS records, the input
+// offset and output length it has reached to DIR/shard-k.checkpoint.
+//
+// A worker that dies is restarted from its checkpoint, checkpointing after
+// every record until it is past the point where it died. If it dies again
+// there, that record is written with status "crashed" and skipped. Running
+// the same command over the same DIR resumes every unfinished shard. The
+// shard outputs are then concatenated in shard order, which is input order.
+const char SHARD_CHECKPOINT_MAGIC[8] = {'O', 'C', 'T', 'S', 'H', 'R', 'D', '\0'};
+const int SHARD_CHECKPOINT_RECORDS = 1024;
+
+struct ShardCheckpoint {
+    char magic[8];
+    uint64_t inputSize;     // size and mtime of the input the shard was cut from
+    int64_t inputModified;
+    uint64_t begin, end;    // the shard's byte range
+    uint64_t offset;        // input bytes named so far
+    uint64_t outputBytes;   // length of the shard output for them
+    uint64_t records;       // records written so far
+    uint64_t done;
+};
+
+// Replaces the checkpoint file through a rename, so it is always a complete one
+bool saveShardCheckpoint(const string& path, const ShardCheckpoint& checkpoint) {
+    string temp = path + ".tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = write(fd, &checkpoint, sizeof(checkpoint)) == (ssize_t)sizeof(checkpoint);
+    close(fd);
+    return ok && rename(temp.c_str(), path.c_str()) == 0;
+}
+
+bool loadShardCheckpoint(const string& path, ShardCheckpoint& checkpoint) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = read(fd, &checkpoint, sizeof(checkpoint)) == (ssize_t)sizeof(checkpoint);
+    close(fd);
+    return ok && memcmp(checkpoint.magic, SHARD_CHECKPOINT_MAGIC, sizeof(SHARD_CHECKPOINT_MAGIC)) == 0;
+}
+
+bool writeAll(int fd, const string& data) {
+    for (size_t written = 0; written < data.size();) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        written += n;
+    }
+    return true;
+}
+
+struct ShardPaths {
+    string output, checkpoint, trace;
+};
+
+// Worker process body: names the lines of the shard from its checkpoint on.
+// Until record `carefulUntil` the checkpoint is saved after every record.
+int runShardWorker(const char* input, ShardCheckpoint checkpoint, const ShardPaths& paths, uint64_t carefulUntil,
+                   const WorkBudget& limits, bool columns, NameCache* cache) {
+    int fd = ::open(paths.output.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fd < 0 || ftruncate(fd, checkpoint.outputBytes) != 0 || lseek(fd, 0, SEEK_END) < 0) return 1;
+
+    ostringstream out;
+    out.setf(ios::fixed);
+    out.precision(3);
+    uint64_t pending = 0;
+    const char* end = input + checkpoint.end;
+    for (const char* line = input + checkpoint.offset; line < end;) {
+        const char* newline = (const char*)memchr(line, '\n', end - line);
+        const char* next = newline ? newline + 1 : end;
+        if (newline != line) {
+            string formula(line, newline ? newline : end);
+            WorkBudget budget;
+            budget.maxSteps = limits.maxSteps;
+            budget.deadlineMs = limits.deadlineMs;
+            MolecularProperties properties;
+            string name = nameFormulaCached<NoTrace>(cache, formula, budget, &properties);
+            const char* status = budget.exceeded ? "budget_exceeded" : name.empty() ? "no_name" : "ok";
+            if (budget.exceeded) name.clear();
+            writeBatchRecord(out, columns, formula, name, properties, status, budget.steps);
+            checkpoint.records++;
+            pending++;
+        }
+        line = next;
+        checkpoint.offset = line - input;
+
+        if (pending >= SHARD_CHECKPOINT_RECORDS || checkpoint.records <= carefulUntil || line == end) {
+            string records = out.str();
+            out.str("");
+            // Output first: a checkpoint never covers records that are not on disk
+            if (!writeAll(fd, records)) return 1;
+            checkpoint.outputBytes += records.size();
+            checkpoint.done = line == end;
+            if (!saveShardCheckpoint(paths.checkpoint, checkpoint)) return 1;
+            pending = 0;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+// Writes the record at the checkpoint as crashed and moves the checkpoint past it
+bool skipCrashedRecord(const char* input, ShardCheckpoint& checkpoint, const ShardPaths& paths, bool columns) {
+    const char* line = input + checkpoint.offset;
+    const char* newline = (const char*)memchr(line, '\n', checkpoint.end - checkpoint.offset);
+    const char* next = newline ? newline + 1 : input + checkpoint.end;
+
+    ostringstream out;
+    out.setf(ios::fixed);
+    out.precision(3);
+    writeBatchRecord(out, columns, string(line, newline ? newline : next), "", MolecularProperties(), "crashed", 0);
+    int fd = ::open(paths.output.c_str(), O_WRONLY | O_CREAT, 0644);
+    bool ok = fd >= 0 && ftruncate(fd, checkpoint.outputBytes) == 0 && lseek(fd, 0, SEEK_END) >= 0 &&
+              writeAll(fd, out.str());
+    if (fd >= 0) close(fd);
+    if (!ok) return false;
+    checkpoint.outputBytes += out.str().size();
+    checkpoint.records++;
+    checkpoint.offset = next - input;
+    checkpoint.done = checkpoint.offset == checkpoint.end;
+    return saveShardCheckpoint(paths.checkpoint, checkpoint);
+}
+
+int runShardedBatchMode(const string& inputPath, int shardCount, string shardDir, const WorkBudget& limits,
+                        bool columns, const string& cachePath, uint64_t cacheSlots) {
+    struct stat info;
+    if (stat(inputPath.c_str(), &info) != 0) {
+        cerr << "Cannot open input: " << inputPath << endl;
+        return 1;
+    }
+    MappedFile file;
+    if (info.st_size > 0 && !file.open(inputPath)) {
+        cerr << "Cannot map input: " << inputPath << endl;
+        return 1;
+    }
+    const char* input = (const char*)file.data;
+    uint64_t size = info.st_size;
+    if (shardDir.empty()) shardDir = inputPath + ".shards";
+    if (mkdir(shardDir.c_str(), 0755) != 0 && errno != EEXIST) {
+        cerr << "Cannot create shard directory: " << shardDir << endl;
+        return 1;
+    }
+    shardCount = max(1, shardCount);
+    auto start = chrono::steady_clock::now();
+
+    // Byte ranges, each starting at a line
+    vector<uint64_t> bounds(shardCount + 1, size);
+    for (int k = 0; k < shardCount; k++) {
+        uint64_t p = max(k > 0 ? bounds[k - 1] : 0, size * k / shardCount);
+        while (p > 0 && p < size && input[p - 1] != '\n') p++;
+        bounds[k] = p;
+    }
+
+    struct Shard {
+        ShardPaths paths;
+        ShardCheckpoint checkpoint;
+        pid_t pid = 0;
+        uint64_t carefulUntil = 0;  // records checkpointed one by one while below this
+        int restarts = 0;
+    };
+    vector<Shard> shards(shardCount);
+    int resumed = 0;
+    for (int k = 0; k < shardCount; k++) {
+        Shard& shard = shards[k];
+        string prefix = shardDir + "/shard-" + to_string(k);
+        shard.paths = {prefix + ".out", prefix + ".checkpoint", prefix + ".trace"};
+        ShardCheckpoint& checkpoint = shard.checkpoint;
+        if (loadShardCheckpoint(shard.paths.checkpoint, checkpoint) && checkpoint.inputSize == size &&
+            checkpoint.inputModified == (int64_t)info.st_mtime && checkpoint.begin == bounds[k] &&
+            checkpoint.end == bounds[k + 1]) {
+            if (checkpoint.offset > checkpoint.begin) resumed++;
+            continue;
+        }
+        checkpoint = {};
+        memcpy(checkpoint.magic, SHARD_CHECKPOINT_MAGIC, sizeof(SHARD_CHECKPOINT_MAGIC));
+        checkpoint.inputSize = size;
+        checkpoint.inputModified = info.st_mtime;
+        checkpoint.begin = checkpoint.offset = bounds[k];
+        checkpoint.end = bounds[k + 1];
+        checkpoint.done = checkpoint.begin == checkpoint.end;
+        if (!saveShardCheckpoint(shard.paths.checkpoint, checkpoint)) {
+            cerr << "Cannot write checkpoint: " << shard.paths.checkpoint << endl;
+            return 1;
+        }
+    }
+
+    // Children leave with _exit, so nothing buffered here may be written twice
+    cout.flush();
+    cerr.flush();
+    auto launch = [&](Shard& shard) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            installDecisionTrace(shard.paths.trace);
+            NameCache nameCache;  // each worker maps the shared cache itself
+            NameCache* cache = nullptr;
+            if (!cachePath.empty() && nameCache.open(cachePath, cacheSlots ? cacheSlots : NAME_CACHE_DEFAULT_SLOTS)) {
+                cache = &nameCache;
+            }
+            _exit(runShardWorker(input, shard.checkpoint, shard.paths, shard.carefulUntil, limits, columns, cache));
+        }
+        shard.pid = pid;
+        return pid > 0;
+    };
+    int running = 0, skipped = 0, restarts = 0;
+    for (Shard& shard : shards) {
+        if (shard.checkpoint.done) continue;
+        if (!launch(shard)) {
+            cerr << "Cannot start shard worker" << endl;
+            return 1;
+        }
+        running++;
+    }
+
+    while (running > 0) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        auto it = find_if(shards.begin(), shards.end(), [&](const Shard& s) { return s.pid == pid; });
+        if (it == shards.end()) continue;
+        Shard& shard = *it;
+        int k = it - shards.begin();
+        running--;
+        shard.pid = 0;
+        if (!loadShardCheckpoint(shard.paths.checkpoint, shard.checkpoint)) {
+            cerr << "Lost checkpoint: " << shard.paths.checkpoint << endl;
+            return 1;
+        }
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0 && shard.checkpoint.done) continue;
+        if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+            cerr << "Shard " << k << " failed writing to " << shardDir << endl;
+            return 1;
+        }
+
+        restarts++;
+        shard.restarts++;
+        if (shard.checkpoint.records < shard.carefulUntil) {
+            // Died twice on the same record: that record is the cause
+            cerr << "Shard " << k << ": skipping record at byte " << shard.checkpoint.offset << " after "
+                 << (WIFSIGNALED(status) ? strsignal(WTERMSIG(status)) : "an abnormal exit") << endl;
+            if (!skipCrashedRecord(input, shard.checkpoint, shard.paths, columns)) {
+                cerr << "Cannot write shard output: " << shard.paths.output << endl;
+                return 1;
+            }
+            skipped++;
+            shard.carefulUntil = 0;
+            if (shard.checkpoint.done) continue;
+        } else {
+            cerr << "Shard " << k << ": worker died ("
+                 << (WIFSIGNALED(status) ? strsignal(WTERMSIG(status)) : "abnormal exit") << "), restarting from byte "
+                 << shard.checkpoint.offset << endl;
+            shard.carefulUntil = shard.checkpoint.records + SHARD_CHECKPOINT_RECORDS;
+        }
+        if (!launch(shard)) {
+            cerr << "Cannot start shard worker" << endl;
+            return 1;
+        }
+        running++;
+    }
+
+    // Merge in shard order; the shard files are only removed once all of them are out
+    ostream& out = cout;
+    if (columns) out << BATCH_COLUMNS << "\n";
+    uint64_t records = 0;
+    for (Shard& shard : shards) {
+        records += shard.checkpoint.records;
+        if (shard.checkpoint.outputBytes == 0) continue;
+        ifstream part(shard.paths.output, ios::binary);
+        out << part.rdbuf();
+    }
+    out.flush();
+    if (!out) return 1;
+    for (Shard& shard : shards) {
+        unlink(shard.paths.output.c_str());
+        unlink(shard.paths.checkpoint.c_str());
+    }
+    rmdir(shardDir.c_str());  // kept when a crash left traces in it
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << "shards=" << shardCount << " records=" << records << " resumed=" << resumed << " restarts=" << restarts
+         << " crashed_records=" << skipped << " seconds=" << seconds << endl;
+    return 0;
+}
+
+// -------------------- SMILES Reader --------------------
+
+// Reads the SMILES subset the naming engine covers straight into a
+// MolecularGraph: the organic-subset atoms C, N, O, F, Cl, Br and I,
+// bracket atoms with a hydrogen count ([CH2], [OH]), single, double and
+// triple bonds, branches and ring closures (digits and %nn). Tokens are
+// read in place from the text. Atoms and bonds go to a scratch table
+// first, so that the groups the formula parser keeps as one atom (COOH,
+// CHO, CN) and halogens (counted on their carbon) come out as the same
+// graph parseMolecularFormula builds for the condensed formula.
+class SmilesReader {
+public:
+    string error;  // why the last parse failed, with the character offset
+    // False when the molecule parsed but has a C=C or C#C bond, or an O or N
+    // outside the COOH, CHO and CN groups: the engine names alkanes only
+    bool nameable = true;
+
+    // Fills `graph`, which must be empty; false on text outside the subset
+    bool parse(const char* text, size_t length, MolecularGraph& graph) {
+        atoms.clear();
+        bonds.clear();
+        branches.clear();
+        fill(begin(ringAtoms), end(ringAtoms), -1);
+        int openRings = 0, previous = -1, order = 0;  // order 0: no bond symbol read
+
+        for (size_t i = 0; i < length;) {
+            char ch = text[i];
+            if (ch == '(' || ch == ')') {
+                if (order) return fail("bond symbol before a branch", i);
+                if (ch == '(') {
+                    if (previous < 0) return fail("branch before the first atom", i);
+                    branches.push_back(previous);
+                } else {
+                    if (branches.empty()) return fail("unmatched ')'", i);
+                    previous = branches.back();
+                    branches.pop_back();
+                }
+                i++;
+                continue;
+            }
+            if (ch == '-' || ch == '=' || ch == '#' || ch == '/' || ch == '\\') {
+                if (order) return fail("two bond symbols in a row", i);
+                order = ch == '=' ? 2 : ch == '#' ? 3 : 1;
+                i++;
+                continue;
+            }
+            if (isdigit((unsigned char)ch) || ch == '%') {
+                size_t at = i;
+                int ring = ch - '0';
+                if (ch == '%') {
+                    if (i + 2 >= length || !isdigit((unsigned char)text[i + 1]) || !isdigit((unsigned char)text[i + 2])) {
+                        return fail("'%' needs a two-digit ring number", at);
+                    }
+                    ring = (text[i + 1] - '0') * 10 + (text[i + 2] - '0');
+                    i += 2;
+                }
+                i++;
+                if (previous < 0) return fail("ring bond before the first atom", at);
+                if (ringAtoms[ring] < 0) {
+                    ringAtoms[ring] = previous;
+                    ringOrders[ring] = order;
+                    openRings++;
+                } else {
+                    if (ringAtoms[ring] == previous) return fail("ring bond to the same atom", at);
+                    if (order && ringOrders[ring] && order != ringOrders[ring]) return fail("conflicting ring bond orders", at);
+                    addBond(ringAtoms[ring], previous, max(max(order, (int)ringOrders[ring]), 1));
+                    ringAtoms[ring] = -1;
+                    openRings--;
+                }
+                order = 0;
+                continue;
+            }
+
+            size_t at = i;
+            Element element = ELEMENT_C;
+            int hydrogens = -1;
+            if (ch == '[') {
+                if (!readBracketAtom(text, length, i, element, hydrogens)) return false;
+            } else if (!readOrganicAtom(text, length, i, element)) {
+                return false;
+            }
+            atoms.push_back({element, (int8_t)hydrogens, (uint32_t)at, 0, 0, -1, -1, -1, ELEMENT_C, 1});
+            int atom = atoms.size() - 1;
+            if (previous >= 0) addBond(previous, atom, max(order, 1));
+            else if (order) return fail("bond symbol before the first atom", at);
+            previous = atom;
+            order = 0;
+        }
+        if (order) return fail("bond symbol at the end", length);
+        if (!branches.empty()) return fail("unclosed branch", length);
+        if (openRings) return fail("unclosed ring bond", length);
+        if (atoms.empty()) return fail("empty SMILES", 0);
+        return build(graph);
+    }
+
+private:
+    struct Atom {
+        Element element;
+        int8_t hydrogens;  // bracket atoms: as written; -1 until build() fills in the implicit count
+        uint32_t position;
+        int valence;       // bond orders to other atoms
+        int bonds;
+        int oxo, hydroxy, nitrile;  // terminal =O, -OH and #N on a carbon, -1 for none
+        AtomKind kind;              // the graph atom it becomes
+        int id;                     // its graph id, 0 if folded into another atom
+    };
+    struct Bond {
+        int from, to, order;
+    };
+
+    vector<Atom> atoms;
+    vector<Bond> bonds;
+    vector<int> branches;    // atoms to return to at ')'
+    int ringAtoms[100];      // atom holding each open ring bond, -1 for none
+    int ringOrders[100];
+
+    bool fail(const char* message, size_t at) {
+        error = string(message) + " at " + to_string(at);
+        return false;
+    }
+
+    void addBond(int from, int to, int order) {
+        atoms[from].valence += order;
+        atoms[to].valence += order;
+        atoms[from].bonds++;
+        atoms[to].bonds++;
+        bonds.push_back({from, to, order});
+    }
+
+    bool readOrganicAtom(const char* text, size_t length, size_t& i, Element& element) {
+        char ch = text[i], next = i + 1 < length ? text[i + 1] : 0;
+        switch (ch) {
+            case 'C': element = next == 'l' ? ELEMENT_CL : ELEMENT_C; break;
+            case 'B':
+                if (next != 'r') return fail("unsupported element B", i);
+                element = ELEMENT_BR;
+                break;
+            case 'N': element = ELEMENT_N; break;
+            case 'O': element = ELEMENT_O; break;
+            case 'F': element = ELEMENT_F; break;
+            case 'I': element = ELEMENT_I; break;
+            case 'c': case 'n': case 'o': case 's': case 'p': case 'b':
+                return fail("aromatic atoms are not supported", i);
+            case '.': return fail("disconnected fragments are not supported", i);
+            default:
+                if (isupper((unsigned char)ch)) return fail("unsupported element", i);
+                return fail("unexpected character", i);
+        }
+        i += element == ELEMENT_CL || element == ELEMENT_BR ? 2 : 1;
+        return true;
+    }
+
+    // [symbol(@...)(Hn)]; isotopes, charges and atom classes are outside the subset
+    bool readBracketAtom(const char* text, size_t length, size_t& i, Element& element, int& hydrogens) {
+        size_t close = i + 1;
+        while (close < length && text[close] != ']') close++;
+        if (close == length) return fail("unclosed '['", i);
+        size_t j = i + 1;
+        if (j < close && isdigit((unsigned char)text[j])) return fail("isotopes are not supported", j);
+        if (j < close && islower((unsigned char)text[j])) return fail("aromatic atoms are not supported", j);
+        int symbol = -1;
+        for (int e = 0; e < ELEMENT_COUNT; e++) {
+            size_t n = strlen(ELEMENTS[e].symbol);
+            if (e != ELEMENT_H && j + n <= close && memcmp(text + j, ELEMENTS[e].symbol, n) == 0 &&
+                (n == 2 || j + 1 == close || !islower((unsigned char)text[j + 1]))) {
+                symbol = e;
+            }
+        }
+        if (symbol < 0) return fail("unsupported element", j);
+        element = (Element)symbol;
+        j += strlen(ELEMENTS[symbol].symbol);
+        while (j < close && text[j] == '@') j++;  // chirality does not change the name
+        hydrogens = 0;
+        if (j < close && text[j] == 'H') {
+            hydrogens = 1;
+            if (++j < close && isdigit((unsigned char)text[j])) hydrogens = text[j++] - '0';
+        }
+        if (j < close) return fail(text[j] == '+' || text[j] == '-' ? "charged atoms are not supported" : "unexpected character", j);
+        i = close + 1;
+        return true;
+    }
+
+    static int defaultValence(Element element) {
+        switch (element) {
+            case ELEMENT_C: return 4;
+            case ELEMENT_N: return 3;
+            case ELEMENT_O: return 2;
+            default: return 1;  // halogens
+        }
+    }
+
+    static bool isHalogen(Element element) {
+        return element == ELEMENT_CL || element == ELEMENT_BR || element == ELEMENT_F || element == ELEMENT_I;
+    }
+
+    bool build(MolecularGraph& graph) {
+        int kept = atoms.size(), hydrogenCount = 0;
+        nameable = true;
+        for (Atom& atom : atoms) {
+            if (atom.valence + max((int)atom.hydrogens, 0) > defaultValence(atom.element)) {
+                return fail("too many bonds on an atom", atom.position);
+            }
+            if (atom.hydrogens < 0) atom.hydrogens = defaultValence(atom.element) - atom.valence;
+            graph.properties.add(atom.element);  // every atom counts, folded or not
+            hydrogenCount += atom.hydrogens;
+        }
+        graph.properties.add(ELEMENT_H, hydrogenCount);
+
+        // O and N atoms bonded only to a carbon, for the groups below
+        for (const Bond& bond : bonds) {
+            if (bond.order > 1 && atoms[bond.from].element == ELEMENT_C && atoms[bond.to].element == ELEMENT_C) nameable = false;
+            for (int side = 0; side < 2; side++) {
+                int end = side ? bond.to : bond.from;
+                Atom& carbon = atoms[side ? bond.from : bond.to];
+                if (atoms[end].bonds != 1 || carbon.element != ELEMENT_C) continue;
+                Element element = atoms[end].element;
+                if (element == ELEMENT_O && bond.order == 2) carbon.oxo = end;
+                else if (element == ELEMENT_O && bond.order == 1 && atoms[end].hydrogens == 1) carbon.hydroxy = end;
+                else if (element == ELEMENT_N && bond.order == 3) carbon.nitrile = end;
+            }
+        }
+
+        // Carbon groups become one atom, as the formula parser reads them;
+        // halogens are left out of the atoms and recorded on their carbon
+        for (Atom& atom : atoms) {
+            atom.kind = atom.element;
+            if (isHalogen(atom.element)) {
+                atom.id = 0;
+                kept--;
+            }
+            if (atom.element != ELEMENT_C) continue;
+            if (atom.oxo >= 0 && atom.hydroxy >= 0 && atom.bonds <= 3) {
+                atom.kind = KIND_COOH;
+                atoms[atom.oxo].id = atoms[atom.hydroxy].id = 0;
+                kept -= 2;
+            } else if (atom.oxo >= 0 && atom.hydrogens == 1 && atom.bonds <= 2) {
+                atom.kind = KIND_CHO;
+                atoms[atom.oxo].id = 0;
+                kept--;
+            } else if (atom.nitrile >= 0 && atom.bonds <= 2) {
+                atom.kind = KIND_CN;
+                atoms[atom.nitrile].id = 0;
+                kept--;
+            }
+        }
+        for (const Atom& atom : atoms) {
+            if ((atom.element == ELEMENT_O || atom.element == ELEMENT_N) && atom.id) nameable = false;
+        }
+        int id = graph.addAtoms(kept);
+        for (Atom& atom : atoms) {
+            if (!atom.id) continue;
+            atom.id = id++;
+            graph.kinds[atom.id] = atom.kind;
+            if (atom.kind < ELEMENT_COUNT) graph.setHydrogens(atom.id, atom.hydrogens);  // group atoms carry none
+        }
+        graph.edges.reserve(bonds.size());
+        for (const Bond& bond : bonds) {
+            const Atom& from = atoms[bond.from];
+            const Atom& to = atoms[bond.to];
+            if (from.id && to.id) {
+                graph.addEdge(from.id, to.id);
+                continue;
+            }
+            const Atom& carbon = from.id ? from : to;
+            const Atom& halogen = from.id ? to : from;
+            if (carbon.kind != ELEMENT_C || !carbon.id || !isHalogen(halogen.element)) continue;
+            for (int type = 1; type <= 4; type++) {
+                if (HALOGEN_ELEMENTS[type] == halogen.element) graph.addHalogen(carbon.id, type);
+            }
+        }
+        return true;
+    }
+
+};
+
+// Names one SMILES string. Returns false, with `error` set, when it is
+// outside the subset SmilesReader takes. The engine names trees only: a
+// ring closure gives an empty name, as a cyclic formula does, and so do
+// C-C multiple bonds and O or N atoms outside a recognised group.
+template <class Trace>
+bool nameSmiles(string_view smiles, WorkBudget& budget, string& name, MolecularProperties* properties, string& error) {
+    static thread_local SmilesReader reader;
+    static thread_local MolecularGraph graph;
+    recordMolecule(smiles);
+    graph.clear();
+    name.clear();
+    if (!reader.parse(smiles.data(), smiles.size(), graph)) {
+        error = reader.error;
+        return false;
+    }
+    if (properties) *properties = graph.properties;
+    if (!reader.nameable) return true;
+    if (!graph.edges.empty() && graph.edges.size() + 2 > (size_t)graph.counter) {  // more bonds than a tree of these atoms has
+        recordDecision(EVENT_RING_CLOSURE, graph.edges.back().first, graph.edges.back().second);
+        return true;
+    }
+    name = processMolecularGraph<Trace>(graph, 0, budget);
+    return true;
+}
+
+// --batch --smiles [--input FILE]: names one SMILES per line, with the same
+// records as --batch. Text outside the subset gets status "invalid_smiles"
+// (and the reason in an "error" field of JSON records). FILE is mapped and
+// read in place; a summary with the parse rate goes to stderr.
+int runSmilesBatchMode(const WorkBudget& limits, bool columns, const string& inputPath, bool stream) {
+    ostream& out = cout;
+    out.setf(ios::fixed);
+    out.precision(3);
+    if (columns) out << BATCH_COLUMNS << "\n";
+
+    long long molecules = 0, invalid = 0;
+    double parseSeconds = 0;
+    string name, error;
+    auto nameOne = [&](string_view smiles) {
+        if (!smiles.empty() && smiles.back() == '\r') smiles.remove_suffix(1);
+        if (smiles.empty()) return;
+        molecules++;
+        WorkBudget budget;
+        budget.maxSteps = limits.maxSteps;
+        budget.deadlineMs = limits.deadlineMs;
+        MolecularProperties properties;
+        if (!nameSmiles<NoTrace>(smiles, budget, name, &properties, error)) {
+            invalid++;
+            writeBatchRecord(out, columns, string(smiles), "", properties, "invalid_smiles", 0, error.c_str());
+        } else {
+            const char* status = budget.exceeded ? "budget_exceeded" : name.empty() ? "no_name" : "ok";
+            if (budget.exceeded) name.clear();
+            writeBatchRecord(out, columns, string(smiles), name, properties, status, budget.steps);
+        }
+        if (stream) out.flush();
+    };
+
+    auto start = chrono::steady_clock::now();
+    if (inputPath.empty()) {
+        string line;
+        while (getline(cin, line)) nameOne(line);
+    } else {
+        struct stat info;
+        if (stat(inputPath.c_str(), &info) != 0) {
+            cerr << "Cannot open input: " << inputPath << endl;
+            return 1;
+        }
+        MappedFile file;
+        if (info.st_size > 0 && !file.open(inputPath)) {
+            cerr << "Cannot map input: " << inputPath << endl;
+            return 1;
+        }
+        const char* text = (const char*)file.data;
+        const char* end = text + file.size;
+
+        // The reader alone over the whole file, for the parse rate
+        SmilesReader reader;
+        MolecularGraph graph;
+        auto parseStart = chrono::steady_clock::now();
+        for (const char* line = text; line < end;) {
+            const char* newline = (const char*)memchr(line, '\n', end - line);
+            const char* lineEnd = newline ? newline : end;
+            graph.clear();
+            reader.parse(line, lineEnd - line - (lineEnd > line && lineEnd[-1] == '\r'), graph);
+            line = newline ? newline + 1 : end;
+        }
+        parseSeconds = chrono::duration<double>(chrono::steady_clock::now() - parseStart).count();
+
+        for (const char* line = text; line < end;) {
+            const char* newline = (const char*)memchr(line, '\n', end - line);
+            nameOne(string_view(line, (newline ? newline : end) - line));
+            line = newline ? newline + 1 : end;
+        }
+    }
+    out.flush();
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << "molecules=" << molecules << " invalid=" << invalid << " molecules_per_s=" << (seconds > 0 ? molecules / seconds : 0);
+    if (parseSeconds > 0) cerr << " parse_per_s=" << molecules / parseSeconds;
+    cerr << endl;
+    return 0;
+}
+
+// -------------------- Decision Trace Decoder --------------------
+
+// --decision-decode FILE: prints a dump, oldest event first, one block per thread
+int runDecisionDecodeMode(const string& path) {
+    ifstream in(path, ios::binary);
+    char magic[8];
+    uint32_t version = 0, count = 0;
+    if (!in.read(magic, sizeof(magic)) || memcmp(magic, DECISION_MAGIC, sizeof(magic)) != 0 ||
+        !in.read((char*)&version, sizeof(version)) || version != DECISION_VERSION || !in.read((char*)&count, sizeof(count))) {
+        cerr << "Not a decision trace: " << path << endl;
+        return 1;
+    }
+    vector<DecisionEvent> events(DECISION_RING_EVENTS);
+    for (uint32_t ring = 0; ring < count; ring++) {
+        uint64_t next = 0;
+        if (!in.read((char*)&next, sizeof(next)) || !in.read((char*)events.data(), events.size() * sizeof(DecisionEvent))) {
+            cerr << "Truncated decision trace: " << path << endl;
+            return 1;
+        }
+        uint64_t first = next > DECISION_RING_EVENTS ? next - DECISION_RING_EVENTS : 0;
+        cout << "== ring " << ring << ": events " << first << ".." << next << (first ? " (older events overwritten)" : "") << endl;
+        for (uint64_t n = first; n < next; n++) {
+            const DecisionEvent& e = events[n & (DECISION_RING_EVENTS - 1)];
+            cout << "#" << n << " ";
+            switch (e.type) {
+                case EVENT_THREAD: cout << "thread " << e.a; break;
+                case EVENT_MOLECULE: {
+                    char prefix[9] = {};
+                    memcpy(prefix, &e.b, min<int>(e.small, 8));
+                    cout << "molecule \"" << prefix << (e.small > 8 ? "..." : "") << "\" length=" << e.small
+                         << " hash=" << hex << e.a << dec;
+                    break;
+                }
+                case EVENT_GRAPH: cout << "graph atoms=" << e.a << " bonds=" << e.b; break;
+                case EVENT_RING_CLOSURE: cout << "ring closure " << e.a << "-" << e.b << " (no name)"; break;
+                case EVENT_CARBONS: cout << "carbons=" << e.a << " cooh=" << e.small; break;
+                case EVENT_CHAIN_TARGET: cout << "longest chains: carbons=" << e.a << " best substituents=" << (int64_t)e.b; break;
+                case EVENT_CHAIN_STARTS: cout << "locant 1: " << e.a << " start atoms kept, substituents=" << e.b; break;
+                case EVENT_LOCANT: cout << "locant " << e.a << ": " << e.b << " partial chains kept, substituents=" << e.small; break;
+                case EVENT_TIED_CHAINS: cout << "tied chains=" << e.a << " (alphabetical rule)"; break;
+                case EVENT_ALPHABETICAL: cout << "alphabetical winner=chain " << e.a; break;
+                case EVENT_CHAIN: cout << "parent chain nodes=" << e.a << " from atom " << (e.b >> 32) << " to " << (uint32_t)e.b; break;
+                case EVENT_HALOGEN:
+                    cout << "halogen on atom " << e.a << ": " << e.b << "x " << formatBranchName(0, e.small); break;
+                case EVENT_BRANCH:
+                    cout << "branch rooted at atom " << e.a << ": depth=" << (e.b >> 32) << " substituents=" << (uint32_t)e.b;
+                    if (e.small) cout << " halogen=" << formatBranchName(0, e.small);
+                    break;
+                case EVENT_KERNEL: cout << (e.small ? "named by the small-molecule kernel" : "kernel handed back"); break;
+                case EVENT_NAME: cout << "name length=" << e.a << " hash=" << hex << e.b << dec; break;
+                case EVENT_BUDGET_EXCEEDED: cout << "budget exceeded steps=" << e.b; break;
+                default: cout << "unknown event type " << e.type;
+            }
+            cout << endl;
+        }
+    }
+    return 0;
+}
+
+// -------------------- Slow-Input Finder --------------------
+
+// Pieces the mutator inserts: the tokens the parser knows, plus the shapes
+// that have been slow before (nested branches, repeat units, halogens)
+const char* FUZZ_TOKENS[] = {"C", "CH", "CH2", "CH3", "(", ")", "(CH3)", "(CH3)2", "(CH2CH3)", "C(CH3)3", "Cl",
+                             "Br", "F", "I", "Cl2", "Cl3", "COOH", "CHO", "CN", "OH", "NH2", "COO", "-O-", "(CH2)",
+                             "2", "3", "4", "9", "(CH(CH3)2)", "(C(CH3)2CH3)", "CCl2"};
+
+const int FUZZ_FEATURE_BITS = 1 << 16;
+
+// One input kept in the fuzzing corpus
+struct FuzzEntry {
+    string formula;
+    long long steps = 0;
+    bool capped = false;  // cut off by the step cap, so `steps` is a lower bound
+    double nanos = 0;
+    double score = 0;  // work per input byte
+};
+
+struct SlowInputFinder {
+    mt19937_64 random;
+    size_t maxLength = 64;
+    long long maxSteps = 1000000;
+    bool byTime = false;  // score wall time per byte instead of budget steps per byte
+    vector<FuzzEntry> corpus;
+    vector<uint64_t> features = vector<uint64_t>(FUZZ_FEATURE_BITS / 64);
+    size_t featureCount = 0;
+
+    explicit SlowInputFinder(uint64_t seed) : random(seed) {}
+
+    size_t pick(size_t n) { return uniform_int_distribution<size_t>(0, n - 1)(random); }
+
+    // Coverage of one run: every decision event it recorded, as (type,
+    // log2 of each field), hashed into the feature bitmap. Returns how many
+    // features were new.
+    size_t collectFeatures(uint64_t firstEvent) {
+        DecisionRing* ring = currentDecisionRing();
+        if (!ring) return 0;
+        uint64_t last = ring->next.load(memory_order_relaxed);
+        size_t added = 0;
+        for (uint64_t n = max(firstEvent, last > DECISION_RING_EVENTS ? last - DECISION_RING_EVENTS : 0); n < last; n++) {
+            const DecisionEvent& e = ring->events[n & (DECISION_RING_EVENTS - 1)];
+            if (e.type == EVENT_MOLECULE || e.type == EVENT_NAME) continue;  // unique per input, no coverage
+            int bucketA = 64 - __builtin_clzll((uint64_t)e.a | 1), bucketB = 64 - __builtin_clzll(e.b | 1);
+            uint64_t bit = mixHash((uint64_t)e.type << 32 | bucketA << 16 | bucketB << 8 | min<int>(e.small, 255)) % FUZZ_FEATURE_BITS;
+            if (!(features[bit / 64] >> (bit % 64) & 1)) {
+                features[bit / 64] |= 1ULL << (bit % 64);
+                added++;
+            }
+        }
+        featureCount += added;
+        return added;
+    }
+
+    // Names `formula` under the step cap; returns the entry and how many new features it reached
+    FuzzEntry run(const string& formula, size_t& newFeatures) {
+        FuzzEntry entry;
+        entry.formula = formula;
+        DecisionRing* ring = currentDecisionRing();
+        uint64_t firstEvent = ring ? ring->next.load(memory_order_relaxed) : 0;
+        WorkBudget budget;
+        budget.maxSteps = maxSteps;
+        auto start = chrono::steady_clock::now();
+        nameFormula<NoTrace>(formula, budget);
+        entry.nanos = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        entry.steps = budget.steps;
+        entry.capped = budget.exceeded;
+        entry.score = (byTime ? entry.nanos : (double)entry.steps) / max<size_t>(formula.size(), 1);
+        newFeatures = collectFeatures(firstEvent);
+        return entry;
+    }
+
+    string mutate(const string& input) {
+        string text = input;
+        int rounds = 1 + pick(4);
+        for (int r = 0; r < rounds; r++) {
+            size_t position = text.empty() ? 0 : pick(text.size() + 1);
+            switch (pick(6)) {
+                case 0:  // insert a token
+                case 1:
+                    text.insert(position, FUZZ_TOKENS[pick(sizeof(FUZZ_TOKENS) / sizeof(FUZZ_TOKENS[0]))]);
+                    break;
+                case 2:  // delete a span
+                    if (!text.empty()) text.erase(min(position, text.size() - 1), 1 + pick(4));
+                    break;
+                case 3: {  // duplicate a span
+                    if (text.empty()) break;
+                    size_t begin = pick(text.size()), length = 1 + pick(min<size_t>(text.size() - begin, 12));
+                    text.insert(position, text.substr(begin, length));
+                    break;
+                }
+                case 4: {  // wrap a span in a branch, sometimes repeated
+                    if (text.empty()) break;
+                    size_t begin = pick(text.size()), length = 1 + pick(min<size_t>(text.size() - begin, 12));
+                    string unit = "(" + text.substr(begin, length) + ")" + (pick(2) ? to_string(2 + pick(8)) : "");
+                    text.replace(begin, length, unit);
+                    break;
+                }
+                case 5: {  // splice in part of another corpus entry
+                    const string& other = corpus[pick(corpus.size())].formula;
+                    if (other.empty()) break;
+                    size_t begin = pick(other.size());
+                    text.insert(position, other.substr(begin, 1 + pick(other.size() - begin)));
+                    break;
+                }
+            }
+        }
+        if (text.size() > maxLength) text.resize(maxLength);
+        return text;
+    }
+
+    // Inputs with more work per byte are mutated more often
+    const FuzzEntry& choose() {
+        size_t best = pick(corpus.size());
+        for (int round = 0; round < 2; round++) {
+            size_t other = pick(corpus.size());
+            if (corpus[other].score > corpus[best].score) best = other;
+        }
+        return corpus[best];
+    }
+};
+
+// --fuzz-slow SEEDS OUT [--iterations N] [--max-length L] [--fuzz-max-steps N] [--seed S] [--keep K] [--by-time]:
+// searches for formulas that make the engine work hard for their size.
+// Mutants that reach new decision-trace features or beat the slowest
+// inputs so far join the corpus. The K inputs with the most work per byte
+// are written to OUT as a perf-regression corpus (formula, steps, bytes,
+// steps per byte, ns), which --bench replays. Steps ending in '+' hit the
+// step cap.
+int runSlowInputMode(const string& seedPath, const string& outPath, long long iterations, size_t maxLength,
+                     long long maxSteps, uint64_t seed, size_t keep, bool byTime) {
+    SlowInputFinder finder(seed);
+    finder.maxLength = maxLength;
+    finder.maxSteps = maxSteps;
+    finder.byTime = byTime;
+
+    vector<string> seeds = {"CH3CH2CH3", "CH3CH(CH3)CH2CH3", "CH3CH(Cl)CH2Br", "CH3(CH2)4COOH", "C(CH3)3CH2C(CH3)3",
+                            "CH3CH(CH2CH3)CH(CH3)CH2CH3", "CH2ClCH2Cl", "CH3CH2-O-CH2CH3"};
+    ifstream in(seedPath);
+    string line;
+    while (getline(in, line)) {
+        string formula = line.substr(0, line.find('\t'));
+        if (!formula.empty() && formula != "formula" && formula.size() <= maxLength) seeds.push_back(formula);
+    }
+    size_t newFeatures;
+    for (const string& formula : seeds) finder.corpus.push_back(finder.run(formula, newFeatures));
+
+    unordered_set<uint64_t> seen;  // hashes of the inputs tried
+    for (const string& formula : seeds) seen.insert(stableHash(formula));
+    vector<FuzzEntry> slowest;  // the `keep` highest scores, by score
+    auto consider = [&](const FuzzEntry& entry) {
+        if (slowest.size() == keep && entry.score <= slowest.back().score) return false;
+        slowest.insert(upper_bound(slowest.begin(), slowest.end(), entry,
+                                   [](const FuzzEntry& a, const FuzzEntry& b) { return a.score > b.score; }), entry);
+        if (slowest.size() > keep) slowest.pop_back();
+        return true;
+    };
+    for (const FuzzEntry& entry : finder.corpus) consider(entry);
+
+    auto start = chrono::steady_clock::now();
+    for (long long i = 1; i <= iterations; i++) {
+        string formula = finder.mutate(finder.choose().formula);
+        if (formula.empty() || !seen.insert(stableHash(formula)).second) continue;
+        FuzzEntry entry = finder.run(formula, newFeatures);
+        bool slow = consider(entry);
+        if (newFeatures > 0 || slow) finder.corpus.push_back(entry);
+        if (i % 1000 == 0 || i == iterations) {
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cerr << "iterations=" << i << " execs_per_s=" << (seconds > 0 ? i / seconds : 0) << " corpus=" << finder.corpus.size()
+                 << " features=" << finder.featureCount << " top_score=" << slowest.front().score
+                 << " top=" << slowest.front().formula << endl;
+        }
+    }
+
+    ofstream out(outPath);
+    if (!out) {
+        cerr << "Cannot write: " << outPath << endl;
+        return 1;
+    }
+    out << "formula\tsteps\tbytes\tsteps_per_byte\tns\n";
+    for (const FuzzEntry& entry : slowest) {
+        out << entry.formula << "\t" << entry.steps << (entry.capped ? "+" : "") << "\t" << entry.formula.size() << "\t"
+            << (double)entry.steps / max<size_t>(entry.formula.size(), 1) << "\t" << (long long)entry.nanos << "\n";
+    }
+    return 0;
+}
+
+// -------------------- Benchmark --------------------
+
+// Swallows everything written to it
+struct DiscardBuffer : streambuf {
+    int overflow(int ch) override { return ch; }
+};
+
+// Molecules/s for naming every formula in `formulas` `repeat` times under one tracing policy
+template <class Trace>
+double benchmarkNaming(const vector<string>& formulas, int repeat, size_t& checksum) {
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < repeat; r++) {
+        for (const string& formula : formulas) {
+            WorkBudget budget;
+            checksum += nameFormula<Trace>(formula, budget).size();
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return seconds > 0 ? formulas.size() * repeat / seconds : 0;
+}
+
+// Molecules/s for naming every formula `repeat` times through the small-molecule kernel, LANES at a time
+double benchmarkKernel(const vector<string>& formulas, int repeat, size_t& checksum) {
+    SmallMoleculeKernel kernel;
+    vector<KernelNamed> results(SmallMoleculeKernel::LANES);
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < repeat; r++) {
+        for (size_t begin = 0; begin < formulas.size(); begin += SmallMoleculeKernel::LANES) {
+            int count = min<size_t>(SmallMoleculeKernel::LANES, formulas.size() - begin);
+            nameWithKernel(kernel, &formulas[begin], count, WorkBudget(), results.data());
+            for (int i = 0; i < count; i++) checksum += results[i].name.size();
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return seconds > 0 ? formulas.size() * repeat / seconds : 0;
+}
+
+// Runs `binary --bench corpusPath --repeat N` and returns the no_trace_per_s
+// it prints (0 if it could not be run). `compiledOut` tells whether that
+// binary was built with -DIUPAC_NO_TRACE.
+double runBaselineBench(const string& binary, const string& corpusPath, int repeat, bool& compiledOut) {
+    compiledOut = false;
+    int fds[2];
+    if (pipe(fds) != 0) return 0;
+    cout.flush();
+    cerr.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        string repeatText = to_string(repeat);
+        execl(binary.c_str(), binary.c_str(), "--bench", corpusPath.c_str(), "--repeat", repeatText.c_str(),
+              (char*)nullptr);
+        _exit(127);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return 0;
+    }
+    string output;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fds[0], buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR)) {
+        if (n > 0) output.append(buffer, n);
+    }
+    close(fds[0]);
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) return 0;
+
+    double perSecond = 0;
+    istringstream lines(output);
+    string line;
+    while (getline(lines, line)) {
+        if (line.rfind("no_trace_per_s=", 0) == 0) perSecond = atof(line.c_str() + strlen("no_trace_per_s="));
+        if (line == "trace_code=compiled_out") compiledOut = true;
+    }
+    return perSecond;
+}
+
+// --bench FILE [--repeat N] [--baseline BINARY]: names the corpus with
+// tracing compiled out and with the verbose dump written to a discarding
+// stream, which is what tool modes paid before tracing became a policy.
+// BINARY, built with -DIUPAC_NO_TRACE, is the baseline that never had tracing.
+int runBenchMode(const string& corpusPath, int repeat, const string& baselinePath) {
+    ifstream corpus(corpusPath);
+    if (!corpus) {
+        cerr << "Cannot open corpus: " << corpusPath << endl;
+        return 1;
+    }
+    vector<string> formulas;
+    vector<long long> recordedSteps;  // second column of a --fuzz-slow corpus, -1 if it hit the cap
+    bool hasSteps = false;
+    string line;
+    while (getline(corpus, line)) {
+        if (line.rfind("formula\tsteps", 0) == 0) hasSteps = true;
+        size_t tab = line.find('\t');
+        string formula = line.substr(0, tab);
+        if (formula.empty() || formula == "formula") continue;
+        formulas.push_back(formula);
+        if (!hasSteps) continue;
+        string steps = tab == string::npos ? "" : line.substr(tab + 1, line.find('\t', tab + 1) - tab - 1);
+        recordedSteps.push_back(!steps.empty() && steps.back() == '+' ? -1 : atoll(steps.c_str()));
+    }
+    if (repeat < 1) repeat = 1;
+
+    size_t checksum = 0;
+    benchmarkNaming<NoTrace>(formulas, 1, checksum);  // warm-up
+    double untraced = benchmarkNaming<NoTrace>(formulas, repeat, checksum);
+
+    DiscardBuffer discard;
+    streambuf* saved = cout.rdbuf(&discard);
+    double discarded = benchmarkNaming<VerboseTrace>(formulas, repeat, checksum);
+    cout.rdbuf(saved);
+
+    // The same corpus through the small-molecule kernel, checked against the per-molecule names
+    SmallMoleculeKernel kernel;
+    vector<KernelNamed> results(SmallMoleculeKernel::LANES);
+    size_t kernelNamed = 0, mismatches = 0;
+    for (size_t begin = 0; begin < formulas.size(); begin += SmallMoleculeKernel::LANES) {
+        int count = min<size_t>(SmallMoleculeKernel::LANES, formulas.size() - begin);
+        nameWithKernel(kernel, &formulas[begin], count, WorkBudget(), results.data());
+        for (int i = 0; i < count; i++) {
+            if (!results[i].fromKernel) continue;
+            kernelNamed++;
+            WorkBudget budget;
+            if (results[i].name != nameFormula<NoTrace>(formulas[begin + i], budget)) mismatches++;
+        }
+    }
+    double batched = benchmarkKernel(formulas, repeat, checksum);
+
+    // Cost of one always-on decision event
+    const int events = 1 << 22;
+    auto eventStart = chrono::steady_clock::now();
+    for (int n = 0; n < events; n++) recordDecision(EVENT_LOCANT, n, n, 1);
+    double eventNs = chrono::duration<double, nano>(chrono::steady_clock::now() - eventStart).count() / events;
+
+    // Memory of the parsed graphs: packed atom records, bonds and run table
+    size_t atoms = 0, graphBytes = 0;
+    for (const string& formula : formulas) {
+        string f1, f2;
+        vector<string> parts = splitEther(formula, f1, f2) ? vector<string>{f1, f2} : vector<string>{formula};
+        for (const string& part : parts) {
+            MolecularGraph molecule;
+            molecule.parseMolecularFormula(part);
+            atoms += molecule.counter - 1;
+            graphBytes += molecule.memoryBytes();
+        }
+    }
+    size_t recordBytes = sizeof(AtomKind) + 3 * sizeof(uint8_t);
+
+    cout << "molecules=" << formulas.size() << " repeat=" << repeat << endl;
+    cout << "trace_code=" << (VerboseTrace::enabled ? "present" : "compiled_out") << endl;
+    cout << "no_trace_per_s=" << untraced << endl;
+    cout << "verbose_discarded_per_s=" << discarded << endl;
+    cout << "speedup=" << (discarded > 0 ? untraced / discarded : 0) << " checksum=" << checksum << endl;
+    if (!baselinePath.empty()) {
+        // Run after this binary's timings so the two never compete for the CPU
+        bool compiledOut;
+        double baseline = runBaselineBench(baselinePath, corpusPath, repeat, compiledOut);
+        if (baseline <= 0) {
+            cerr << "Cannot run baseline: " << baselinePath << endl;
+            return 1;
+        }
+        if (!compiledOut) cerr << "Baseline " << baselinePath << " was not built with -DIUPAC_NO_TRACE" << endl;
+        cout << "baseline_per_s=" << baseline << " no_trace_vs_baseline=" << untraced / baseline << endl;
+    }
+    cout << "kernel_per_s=" << batched << " kernel_speedup=" << (untraced > 0 ? batched / untraced : 0)
+         << " kernel_named=" << kernelNamed << " kernel_mismatches=" << mismatches << endl;
+    cout << "decision_event_ns=" << eventNs << endl;
+
+    // A perf-regression corpus also checks that no input takes more steps than when it was recorded
+    if (hasSteps) {
+        int regressions = 0, checked = 0;
+        for (size_t i = 0; i < formulas.size(); i++) {
+            if (recordedSteps[i] < 0) continue;  // no exact count to compare with
+            checked++;
+            WorkBudget budget;
+            budget.maxSteps = 2 * recordedSteps[i] + 1000;
+            nameFormula<NoTrace>(formulas[i], budget);
+            if (budget.steps > recordedSteps[i] + recordedSteps[i] / 10 + 16) {
+                regressions++;
+                cerr << "step regression: " << formulas[i] << " recorded=" << recordedSteps[i] << " now=" << budget.steps
+                     << (budget.exceeded ? "+" : "") << endl;
+            }
+        }
+        cout << "step_regressions=" << regressions << " of " << checked << endl;
+        if (regressions > 0) return 1;
+    }
+    cout << "atoms=" << atoms << " atom_record_bytes=" << recordBytes
+         << " graph_bytes_per_atom=" << (atoms ? (double)graphBytes / atoms : 0) << endl;
+    return 0;
+}
+
+// Structured result line for a run that was cut off by its work budget
+void reportBudgetExceeded(const WorkBudget& budget) {
+    cout << "BUDGET EXCEEDED: steps=" << budget.steps << " max_steps=" << budget.maxSteps
+         << " elapsed_ms=" << budget.elapsedMs() << " deadline_ms=" << budget.deadlineMs << endl;
+}
+
+// Exit status for a run cut off by its work budget
+const int EXIT_BUDGET_EXCEEDED = 3;
+
+int main(int argc, char* argv[]) {
+    WorkBudget budget;
+    string mode, modeArgument, outputPath, inputPath, cachePath;
+    uint64_t cacheSlots = 0;
+    int repeat = 1;
+    long long iterations = 100000, fuzzMaxSteps = 1000000;
+    size_t maxLength = 64, keep = 100;
+    uint64_t seed = 1;
+    bool byTime = false;
+    bool columns = false, stream = false, kernel = false, pipeline = false, smiles = false;
+    PipelineOptions pipelineOptions;
+    int halogenCount = 0, threadCount = 0, shardCount = 0;
+    int fingerprintBits = 1024, pathLength = FINGERPRINT_PATH_LENGTH, topK = 10;
+    string halogenSymbol = "Cl", decisionDumpPath, shardDir, baselinePath;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--reverse") == 0 || strcmp(argv[i], "--batch") == 0) mode = argv[i];
+        else if (strcmp(argv[i], "--columns") == 0) columns = true;
+        else if (strcmp(argv[i], "--stream") == 0) stream = true;
+        else if (strcmp(argv[i], "--kernel") == 0) kernel = true;
+        else if (strcmp(argv[i], "--smiles") == 0) smiles = true;
+        else if (strcmp(argv[i], "--pipeline") == 0) pipeline = true;
+        else if (strcmp(argv[i], "--pipeline-stats") == 0) pipelineOptions.stats = true;
+        else if (strcmp(argv[i], "--parse-workers") == 0 && hasValue) pipelineOptions.parseWorkers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--analyze-workers") == 0 && hasValue) pipelineOptions.analyzeWorkers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--queue-depth") == 0 && hasValue) pipelineOptions.queueDepth = max(2, atoi(argv[++i]));
+        else if ((strcmp(argv[i], "--roundtrip") == 0 || strcmp(argv[i], "--isomers") == 0 ||
+                  strcmp(argv[i], "--index-query") == 0 || strcmp(argv[i], "--fp-search") == 0 ||
+                  strcmp(argv[i], "--cache-compact") == 0 || strcmp(argv[i], "--cache-stats") == 0 ||
+                  strcmp(argv[i], "--bench") == 0 || strcmp(argv[i], "--decision-decode") == 0) && hasValue) {
+            mode = argv[i];
+            modeArgument = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--index-build") == 0 || strcmp(argv[i], "--fp-build") == 0 ||
+                  strcmp(argv[i], "--compile") == 0 || strcmp(argv[i], "--fuzz-slow") == 0) && i + 2 < argc) {
+            mode = argv[i];
+            modeArgument = argv[++i];
+            outputPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--max-steps") == 0 && hasValue) budget.maxSteps = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--deadline-ms") == 0 && hasValue) budget.deadlineMs = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--halogens") == 0 && hasValue) halogenCount = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--halogen") == 0 && hasValue) halogenSymbol = argv[++i];
+        else if (strcmp(argv[i], "--threads") == 0 && hasValue) threadCount = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--bits") == 0 && hasValue) fingerprintBits = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--path-length") == 0 && hasValue) pathLength = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--top") == 0 && hasValue) topK = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--input") == 0 && hasValue) inputPath = argv[++i];
+        else if (strcmp(argv[i], "--name-cache") == 0 && hasValue) cachePath = argv[++i];
+        else if (strcmp(argv[i], "--shards") == 0 && hasValue) shardCount = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--shard-dir") == 0 && hasValue) shardDir = argv[++i];
+        else if (strcmp(argv[i], "--cache-slots") == 0 && hasValue) cacheSlots = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--repeat") == 0 && hasValue) repeat = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--baseline") == 0 && hasValue) baselinePath = argv[++i];
+        else if (strcmp(argv[i], "--decision-dump") == 0 && hasValue) decisionDumpPath = argv[++i];
+        else if (strcmp(argv[i], "--iterations") == 0 && hasValue) iterations = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--max-length") == 0 && hasValue) maxLength = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--fuzz-max-steps") == 0 && hasValue) fuzzMaxSteps = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && hasValue) seed = strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--keep") == 0 && hasValue) keep = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--by-time") == 0) byTime = true;
+    }
+
+    if (mode == "--decision-decode") return runDecisionDecodeMode(modeArgument);
+    installDecisionTrace(decisionDumpPath);
+
+    if (mode == "--reverse") return runReverseMode();
+    if (mode == "--roundtrip") return runRoundTripMode(modeArgument);
+    if (mode == "--isomers") return runIsomerMode(atoi(modeArgument.c_str()), halogenCount, halogenSymbol, threadCount);
+    if (mode == "--batch" && smiles) return runSmilesBatchMode(budget, columns, inputPath, stream);
+    if (mode == "--batch" && shardCount > 0) {
+        if (inputPath.empty() || isCompiledMoleculeFile(inputPath)) {
+            cerr << "--shards needs a text --input FILE" << endl;
+            return 1;
+        }
+        return runShardedBatchMode(inputPath, shardCount, shardDir, budget, columns, cachePath, cacheSlots);
+    }
+    if (mode == "--batch" && !inputPath.empty()) {
+        if (isCompiledMoleculeFile(inputPath)) return runCompiledBatchMode(inputPath, budget, columns);
+        if (!freopen(inputPath.c_str(), "r", stdin)) {
+            cerr << "Cannot open input: " << inputPath << endl;
+            return 1;
+        }
+    }
+    if (mode == "--cache-compact") return runCacheCompactMode(modeArgument, cacheSlots);
+    if (mode == "--cache-stats") return runCacheStatsMode(modeArgument);
+    if (mode == "--bench") return runBenchMode(modeArgument, repeat, baselinePath);
+    if (mode == "--fuzz-slow") {
+        return runSlowInputMode(modeArgument, outputPath, iterations, maxLength, fuzzMaxSteps, seed, keep, byTime);
+    }
+
+    // A cache that cannot be opened only costs the speed-up
+    NameCache nameCache;
+    NameCache* cache = nullptr;
+    if (!cachePath.empty() && mode == "--batch") {
+        if (nameCache.open(cachePath, cacheSlots ? cacheSlots : NAME_CACHE_DEFAULT_SLOTS)) cache = &nameCache;
+        else cerr << "Name cache unavailable: " << cachePath << endl;
+    }
+
+    if (mode == "--batch" && pipeline) return runPipelinedBatchMode(budget, columns, cache, stream, pipelineOptions);
+    if (mode == "--batch") return runBatchMode(budget, columns, cache, stream, kernel);
+    if (mode == "--compile") return runCompileMode(modeArgument, outputPath, budget);
+    if (mode == "--index-build") return runIndexBuildMode(modeArgument, outputPath);
+    if (mode == "--index-query") return runIndexQueryMode(modeArgument);
+    if (mode == "--fp-build") return runFingerprintBuildMode(modeArgument, outputPath, fingerprintBits, pathLength);
+    if (mode == "--fp-search") return runFingerprintSearchMode(modeArgument, topK, threadCount);
+
+    string formula;
+    cout << (smiles ? "ENTER THE SMILES: " : "ENTER THE MOLECULAR FORMULA: ");
+    getline(cin, formula);
+    cout << endl;
+
+    if (smiles) {
+        string name, error;
+        MolecularProperties properties;
+        if (!nameSmiles<VerboseTrace>(formula, budget, name, &properties, error)) {
+            cout << "SMILES error: " << error << endl;
+            return 1;
+        }
+        if (budget.exceeded) {
+            reportBudgetExceeded(budget);
+            return EXIT_BUDGET_EXCEEDED;
+        }
+        // Printed by the dump otherwise
+        if constexpr (!VerboseTrace::enabled) cout << "IUPAC Name: " << name << endl;
+        printProperties(properties);
+        return 0;
+    }
+
+    string f1, f2;
+    bool ether = splitEther(formula, f1, f2);
+    // Not through the name cache: a hit would skip the debug dump the web page shows
+    MolecularProperties properties;
+    string name = nameFormula<VerboseTrace>(formula, budget, &properties);
+    if (budget.exceeded) {
+        reportBudgetExceeded(budget);
+        // Only on request: the server runs one process per request, and a
+        // default per-PID dump for every hard formula would fill /tmp
+        if (!decisionDumpPath.empty() && dumpDecisionTrace()) cerr << "Decision trace written to " << decisionRegistry().dumpPath << endl;
+        return EXIT_BUDGET_EXCEEDED;
+    }
+    if (ether) {
+        cout << "IUPAC NAME: " << name << endl;
+    } else if constexpr (!VerboseTrace::enabled) {
+        cout << "IUPAC Name: " << name << endl;
+    }
+    printProperties(properties);
+
+    return 0;
+}
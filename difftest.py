@@ -0,0 +1,234 @@
+"""Differential harness for the naming engines.
+
+Runs every engine over the same corpus, diffs each engine's names against
+the first (reference) engine, sorts disagreements into classes and reports
+per-engine throughput side by side.
+
+    python difftest.py --corpus formulas.txt
+    python difftest.py --golden golden_names.tsv --engine current="./toolkitnew --batch"
+    python difftest.py --synthetic 10 --halogens 1 \
+        --engine reference=./toolkit \
+        --engine current="./toolkitnew --batch" \
+        --engine cached="./toolkitnew --batch --name-cache /tmp/names.bin"
+
+An engine command containing --batch is fed the whole corpus on stdin and
+read as batch-mode JSON lines. Any other command is run once per formula,
+the way /get_iupac runs it, and its last "IUPAC Name:" line is taken.
+main.cpp (built as ./toolkit) only has the interactive interface.
+
+With --golden, the reference is a formula<TAB>name file of hand-checked
+names instead of an engine, and the exit status is 1 if any engine
+disagrees with it.
+
+--kernel-check compares the small-molecule kernel with the default batch
+path and exits 1 on any difference. The kernel names molecules with its
+own copy of the chain and substituent rules, so run it over the isomer
+corpus whenever those rules change:
+
+    python difftest.py --synthetic 9 --halogens 1 --kernel-check
+"""
+import argparse
+import json
+import re
+import shlex
+import subprocess
+import sys
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+DEFAULT_ENGINES = ["toolkit=./toolkit", "toolkitnew=./toolkitnew --batch"]
+KERNEL_ENGINES = ["batch=./toolkitnew --batch", "kernel=./toolkitnew --batch --kernel"]
+
+# Disagreement classes, most specific first
+CLASSES = [
+    "engine_error",       # an engine crashed, timed out or printed no name
+    "missing_name",       # one engine gave a name, the other an empty one
+    "formatting",         # equal apart from spacing and capitalization
+    "parent_chain",       # different parent stem or suffix
+    "halogen",            # halogen prefixes differ
+    "substituent_style",  # same skeleton, substituent written differently (isopropyl vs (1-methylethyl))
+    "multiplicity",       # same substituents, different grouping or multiplying prefix
+    "locants",            # same words, different numbers
+]
+
+HALOGENS = ("fluoro", "chloro", "bromo", "iodo")
+
+def load_golden(path):
+    with open(path) as f:
+        rows = [line.rstrip("\n").split("\t") for line in f]
+    return [(row[0], row[1]) for row in rows if len(row) >= 2 and row[0] != "formula"]
+
+def load_corpus(args):
+    if args.golden:
+        return [formula for formula, _ in load_golden(args.golden)]
+    if args.corpus:
+        with open(args.corpus) as f:
+            formulas = [line.split("\t")[0].strip() for line in f]
+        return [f for f in formulas if f and f != "formula"]
+    command = ["./toolkitnew", "--isomers", str(args.synthetic), "--halogens", str(args.halogens)]
+    output = subprocess.run(command, capture_output=True, check=True).stdout.decode()
+    return [line.split("\t")[0] for line in output.splitlines() if line]
+
+def name_from_output(output):
+    names = re.findall(r"^IUPAC N(?:ame|AME): ?(.*)$", output, re.MULTILINE)
+    return names[-1].strip() if names else None
+
+def run_interactive(command, formula, timeout):
+    try:
+        result = subprocess.run(command, input=(formula + "\n").encode(), capture_output=True, timeout=timeout)
+    except subprocess.TimeoutExpired:
+        return None, "timeout"
+    name = name_from_output(result.stdout.decode(errors="replace"))
+    if result.returncode != 0:
+        return name, "exit %d" % result.returncode
+    return name, None if name is not None else "no name printed"
+
+def run_engine(command, formulas, args):
+    """Names every formula; returns ([(name, error)], seconds)"""
+    start = time.monotonic()
+    if "--batch" in command:
+        output = subprocess.run(command, input="".join(f + "\n" for f in formulas).encode(),
+                                capture_output=True).stdout.decode()
+        results = []
+        for line in output.splitlines():
+            record = json.loads(line)
+            error = None if record["status"] in ("ok", "no_name") else record["status"]
+            results.append((record["name"], error))
+        results += [(None, "missing from batch output")] * (len(formulas) - len(results))
+    else:
+        with ThreadPoolExecutor(args.jobs) as pool:
+            results = list(pool.map(lambda f: run_interactive(command, f, args.timeout), formulas))
+    return results, time.monotonic() - start
+
+def words(name):
+    return re.findall(r"[A-Za-z]+", name.lower())
+
+def parent(name):
+    # The parent chain and suffix follow the last substituent prefix: "3-ethylHexane" -> "hexane"
+    match = re.search(r"([A-Z][a-z]+(?: acid| ether)?|[a-z]*ane|[a-z]*oic acid)$", name)
+    return match.group(1).lower() if match else name.lower()
+
+def expand_multipliers(name):
+    # (2,2)-dimethyl and 2-methyl-2-methyl describe the same substituents
+    result = []
+    for word in words(name):
+        for prefix, count in (("tri", 3), ("di", 2)):
+            if word.startswith(prefix) and len(word) > len(prefix) + 2:
+                result += [word[len(prefix):]] * count
+                break
+        else:
+            result.append(word)
+    return sorted(result)
+
+def halogen_counts(name):
+    # Substring counts, so halogens inside complex substituents (chloromethyl) count too
+    expanded = " ".join(expand_multipliers(name))
+    return [expanded.count(halogen) for halogen in HALOGENS]
+
+def classify(reference, candidate):
+    (ref_name, ref_error), (name, error) = reference, candidate
+    if ref_error or error:
+        return "engine_error"
+    if not ref_name or not name:
+        return "missing_name"
+    if "".join(ref_name.split()).lower() == "".join(name.split()).lower():
+        return "formatting"
+    if parent(ref_name) != parent(name):
+        return "parent_chain"
+    if halogen_counts(ref_name) != halogen_counts(name):
+        return "halogen"
+    if expand_multipliers(ref_name) != expand_multipliers(name):
+        return "substituent_style" if "(" in ref_name + name else "multiplicity"
+    if words(ref_name) != words(name):
+        return "multiplicity"
+    return "locants"
+
+def main():
+    parser = argparse.ArgumentParser(description="Differential test of the naming engines")
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument("--corpus", help="formula file, one per line (first tab column)")
+    source.add_argument("--synthetic", type=int, metavar="N", help="all isomers of CnH2n+2 from toolkitnew")
+    source.add_argument("--golden", help="formula<TAB>expected name file; the expected names are the reference")
+    parser.add_argument("--halogens", type=int, default=0)
+    parser.add_argument("--engine", action="append", metavar="NAME=COMMAND",
+                        help="engine to compare; the first is the reference (default: %s)" % ", ".join(DEFAULT_ENGINES))
+    parser.add_argument("--jobs", type=int, default=4, help="parallel processes for interactive engines")
+    parser.add_argument("--timeout", type=float, default=10.0)
+    parser.add_argument("--samples", type=int, default=5, help="examples kept per disagreement class")
+    parser.add_argument("--out", help="write every disagreement here as TSV")
+    parser.add_argument("--kernel-check", action="store_true",
+                        help="compare --kernel with the default batch path; exit 1 on any difference")
+    args = parser.parse_args()
+    if args.kernel_check and (args.engine or args.golden):
+        sys.exit("--kernel-check runs its own engines and cannot take --engine or --golden")
+
+    engines = []
+    for spec in args.engine or (KERNEL_ENGINES if args.kernel_check else DEFAULT_ENGINES):
+        name, _, command = spec.partition("=")
+        if not command:
+            sys.exit("engine must be NAME=COMMAND: " + spec)
+        engines.append((name, shlex.split(command)))
+    formulas = load_corpus(args)
+
+    results = {}
+    throughput = {}
+    if args.golden:
+        results["golden"] = [(name, None) for _, name in load_golden(args.golden)]
+        engines.insert(0, ("golden", None))
+    for name, command in engines:
+        if command is None:
+            continue
+        results[name], seconds = run_engine(command, formulas, args)
+        errors = sum(1 for _, error in results[name] if error)
+        throughput[name] = {"seconds": round(seconds, 3),
+                            "formulas_per_s": round(len(formulas) / seconds, 1) if seconds else 0.0,
+                            "errors": errors}
+
+    reference = engines[0][0]
+    comparisons = {}
+    rows = []
+    for name, _ in engines[1:]:
+        counts = {c: 0 for c in CLASSES}
+        samples = {c: [] for c in CLASSES}
+        agree = 0
+        for formula, ref, candidate in zip(formulas, results[reference], results[name]):
+            if ref == candidate:
+                agree += 1
+                continue
+            kind = classify(ref, candidate)
+            counts[kind] += 1
+            row = {"formula": formula, reference: ref[0] or ref[1], name: candidate[0] or candidate[1]}
+            if len(samples[kind]) < args.samples:
+                samples[kind].append(row)
+            rows.append((name, kind, formula, ref[0] or "", ref[1] or "", candidate[0] or "", candidate[1] or ""))
+        comparisons[name] = {"agree": agree,
+                             "disagree": len(formulas) - agree,
+                             "agreement": round(agree / len(formulas), 4) if formulas else 1.0,
+                             "classes": {c: n for c, n in counts.items() if n},
+                             "samples": {c: s for c, s in samples.items() if s}}
+
+    if args.out:
+        with open(args.out, "w") as f:
+            f.write("engine\tclass\tformula\treference_name\treference_error\tname\terror\n")
+            for row in rows:
+                f.write("\t".join(row) + "\n")
+
+    report = {"corpus_size": len(formulas), "reference": reference,
+              "throughput": throughput, "comparisons": comparisons}
+    print(json.dumps(report, indent=2))
+
+    # Throughput side by side for a quick read
+    width = max(len(name) for name, _ in engines)
+    for name, _ in engines:
+        if name not in throughput:
+            continue
+        t = throughput[name]
+        agreement = comparisons[name]["agreement"] if name in comparisons else 1.0
+        print("%-*s  %10.1f formulas/s  %5d errors  %6.2f%% agree" % (width, name, t["formulas_per_s"], t["errors"],
+                                                                     agreement * 100), file=sys.stderr)
+
+    if (args.golden or args.kernel_check) and any(c["disagree"] for c in comparisons.values()):
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main()
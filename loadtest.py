@@ -0,0 +1,279 @@
+"""Load generator for the naming service.
+
+Replays a formula corpus against the HTTP server or straight against the
+engine and prints a JSON report with throughput, latency percentiles and
+error rate.
+
+    python loadtest.py --corpus formulas.txt --target http --concurrency 8 --duration 30
+    python loadtest.py --synthetic 12 --target engine-batch --rate 2000 --duration 10
+
+Targets:
+  http          POST /get_iupac on --url, one formula per request
+  http-batch    POST /get_iupac_batch on --url, --batch-size formulas per request
+  engine        one ./toolkitnew process per formula (what /get_iupac does)
+  engine-batch  one long-lived ./toolkitnew --batch --stream per worker
+
+Closed loop (default): --concurrency workers each send their next request
+as soon as the previous one completes. Open loop (--rate R): requests are
+scheduled at R per second regardless of how fast they complete, and latency
+is measured from the scheduled time, so queueing delay is not hidden when the
+target falls behind.
+"""
+import argparse
+import itertools
+import json
+import queue
+import subprocess
+import sys
+import threading
+import time
+import urllib.error
+import urllib.request
+
+ENGINE = "./toolkitnew"
+
+def load_corpus(args):
+    if args.corpus:
+        with open(args.corpus) as f:
+            formulas = [line.split("\t")[0].strip() for line in f]
+        formulas = [f for f in formulas if f and f != "formula"]
+    else:
+        # The engine's isomer enumerator is the synthetic generator
+        command = [ENGINE, "--isomers", str(args.synthetic), "--halogens", str(args.halogens)]
+        output = subprocess.run(command, capture_output=True, check=True).stdout.decode()
+        formulas = [line.split("\t")[0] for line in output.splitlines() if line]
+    if not formulas:
+        sys.exit("empty corpus")
+    return formulas
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0.0
+    index = min(len(sorted_values) - 1, int(p * len(sorted_values)))
+    return sorted_values[index]
+
+class Target:
+    """Sends one request; returns None on success or an error kind."""
+
+    def __init__(self, args):
+        self.args = args
+        self.local = threading.local()
+
+    def close(self):
+        pass
+
+class HttpTarget(Target):
+    def post(self, path, body, content_type="application/json"):
+        request = urllib.request.Request(self.args.url + path, data=body, headers={"Content-Type": content_type})
+        with urllib.request.urlopen(request, timeout=self.args.timeout) as response:
+            return response.read()
+
+    def send(self, formulas):
+        try:
+            if self.args.target == "http":
+                result = json.loads(self.post("/get_iupac", json.dumps({"formula": formulas[0]}).encode()))
+                return result.get("error") and "error: " + result["error"]
+            lines = self.post("/get_iupac_batch", json.dumps(formulas).encode()).splitlines()
+            if len(lines) != len(formulas):
+                return "short batch"
+            errors = [json.loads(line).get("error") for line in lines]
+            return next(("error: " + e for e in errors if e), None)
+        except urllib.error.HTTPError as e:
+            return "http %d" % e.code
+        except (urllib.error.URLError, OSError) as e:
+            return "connection: %s" % getattr(e, "reason", e)
+
+class EngineTarget(Target):
+    def send(self, formulas):
+        try:
+            result = subprocess.run([ENGINE, "--max-steps", str(self.args.max_steps)], input=formulas[0].encode(),
+                                    capture_output=True, timeout=self.args.timeout)
+        except subprocess.TimeoutExpired:
+            return "timeout"
+        if result.returncode != 0:
+            return "exit %d" % result.returncode
+        return None if b"Molecular Formula:" in result.stdout else "no output"
+
+class EngineBatchTarget(Target):
+    def __init__(self, args):
+        super().__init__(args)
+        self.engines = []
+        self.lock = threading.Lock()
+
+    def engine(self):
+        engine = getattr(self.local, "engine", None)
+        if engine is None or engine.poll() is not None:
+            engine = subprocess.Popen([ENGINE, "--batch", "--stream", "--max-steps", str(self.args.max_steps)],
+                                      stdin=subprocess.PIPE, stdout=subprocess.PIPE, bufsize=1,
+                                      universal_newlines=True)
+            self.local.engine = engine
+            with self.lock:
+                self.engines.append(engine)
+        return engine
+
+    def send(self, formulas):
+        engine = self.engine()
+        try:
+            engine.stdin.write("".join(f + "\n" for f in formulas))
+            engine.stdin.flush()
+            error = None
+            for _ in formulas:
+                line = engine.stdout.readline()
+                if not line:
+                    return "engine exited"
+                status = json.loads(line)["status"]
+                if status != "ok" and error is None:
+                    error = "status: " + status
+            return error
+        except OSError:
+            return "engine exited"
+
+    def close(self):
+        for engine in self.engines:
+            engine.stdin.close()
+            engine.wait()
+
+TARGETS = {"http": HttpTarget, "http-batch": HttpTarget, "engine": EngineTarget, "engine-batch": EngineBatchTarget}
+
+class LockedIterator:
+    """Lets worker threads share one generator"""
+
+    def __init__(self, iterator):
+        self.iterator = iterator
+        self.lock = threading.Lock()
+
+    def __iter__(self):
+        return self
+
+    def __next__(self):
+        with self.lock:
+            return next(self.iterator)
+
+class Recorder:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.latencies = []
+        self.errors = {}
+
+    def record(self, latency, error, count):
+        with self.lock:
+            self.latencies.append(latency)
+            if error:
+                self.errors[error] = self.errors.get(error, 0) + count
+
+def run_closed_loop(target, batches, args, recorder, stop_at):
+    def worker():
+        while time.monotonic() < stop_at:
+            batch = next(batches, None)
+            if batch is None:
+                return
+            start = time.monotonic()
+            error = target.send(batch)
+            recorder.record(time.monotonic() - start, error, len(batch))
+
+    threads = [threading.Thread(target=worker) for _ in range(args.concurrency)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+def run_open_loop(target, batches, args, recorder, stop_at):
+    # The scheduler enqueues (scheduled time, batch); --concurrency workers
+    # drain it. A worker that starts late still charges the wait to latency.
+    work = queue.Queue()
+
+    def worker():
+        while True:
+            item = work.get()
+            if item is None:
+                return
+            scheduled, batch = item
+            error = target.send(batch)
+            recorder.record(time.monotonic() - scheduled, error, len(batch))
+
+    threads = [threading.Thread(target=worker) for _ in range(args.concurrency)]
+    for thread in threads:
+        thread.start()
+    interval = 1.0 / args.rate
+    next_time = time.monotonic()
+    while next_time < stop_at:
+        batch = next(batches, None)
+        if batch is None:
+            break
+        delay = next_time - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+        work.put((next_time, batch))
+        next_time += interval
+    for _ in threads:
+        work.put(None)
+    for thread in threads:
+        thread.join()
+
+def main():
+    parser = argparse.ArgumentParser(description="Load test for the naming service")
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument("--corpus", help="formula file, one per line (first tab column)")
+    source.add_argument("--synthetic", type=int, metavar="N", help="all isomers of CnH2n+2 from the engine")
+    parser.add_argument("--halogens", type=int, default=0, help="halogens per synthetic isomer")
+    parser.add_argument("--target", choices=sorted(TARGETS), default="http")
+    parser.add_argument("--url", default="http://127.0.0.1:5000")
+    parser.add_argument("--concurrency", type=int, default=4)
+    parser.add_argument("--rate", type=float, help="open loop at this many requests/s")
+    parser.add_argument("--duration", type=float, default=10.0, help="seconds")
+    parser.add_argument("--requests", type=int, help="stop after this many requests")
+    parser.add_argument("--batch-size", type=int, default=1, help="formulas per request for batch targets")
+    parser.add_argument("--max-steps", type=int, default=200000, help="engine work budget for engine targets")
+    parser.add_argument("--timeout", type=float, default=30.0, help="per-request timeout in seconds")
+    args = parser.parse_args()
+
+    formulas = load_corpus(args)
+    batch_size = args.batch_size if args.target in ("http-batch", "engine-batch") else 1
+    cycle = itertools.cycle(formulas)
+    batches = (list(itertools.islice(cycle, batch_size)) for _ in itertools.count())
+    if args.requests:
+        batches = itertools.islice(batches, args.requests)
+    batches = LockedIterator(batches)
+
+    target = TARGETS[args.target](args)
+    recorder = Recorder()
+    start = time.monotonic()
+    stop_at = start + args.duration
+    if args.rate:
+        run_open_loop(target, batches, args, recorder, stop_at)
+    else:
+        run_closed_loop(target, batches, args, recorder, stop_at)
+    elapsed = time.monotonic() - start
+    target.close()
+
+    latencies = sorted(recorder.latencies)
+    requests = len(latencies)
+    errors = sum(recorder.errors.values())
+    ms = lambda seconds: round(seconds * 1000, 3)
+    report = {
+        "target": args.target,
+        "mode": "open" if args.rate else "closed",
+        "concurrency": args.concurrency,
+        "rate": args.rate,
+        "batch_size": batch_size,
+        "corpus_size": len(formulas),
+        "requests": requests,
+        "formulas": requests * batch_size,
+        "duration_s": round(elapsed, 3),
+        "throughput_rps": round(requests / elapsed, 2) if elapsed else 0.0,
+        "formulas_per_s": round(requests * batch_size / elapsed, 2) if elapsed else 0.0,
+        "error_rate": errors / (requests * batch_size) if requests else 0.0,
+        "errors": recorder.errors,
+        "latency_ms": {
+            "mean": ms(sum(latencies) / requests) if requests else 0.0,
+            "p50": ms(percentile(latencies, 0.50)),
+            "p90": ms(percentile(latencies, 0.90)),
+            "p99": ms(percentile(latencies, 0.99)),
+            "p999": ms(percentile(latencies, 0.999)),
+            "max": ms(latencies[-1]) if latencies else 0.0,
+        },
+    }
+    print(json.dumps(report, indent=2))
+
+if __name__ == "__main__":
+    main()
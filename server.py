@@ -1,8 +1,41 @@
-from flask import Flask, request, jsonify, render_template, redirect, url_for
+from flask import Flask, Response, request, jsonify, render_template, redirect, url_for, stream_with_context
+import json
+import os
+import queue
 import subprocess
+import threading
+import time
 
 app = Flask(__name__)
 
+# Work budget handed to the engine; it stops cooperatively and reports
+# "budget exceeded" once either limit is hit. The subprocess timeout is
+# only a last-resort backstop for a hung process.
+ENGINE_MAX_STEPS = 200000
+ENGINE_DEADLINE_MS = 500
+ENGINE_TIMEOUT_S = 5
+
+# Name cache shared by every engine process on the host; created on first use
+ENGINE_NAME_CACHE = "name_cache.bin"
+
+# Exit status the engine uses for a run cut off by its work budget
+EXIT_BUDGET_EXCEEDED = 3
+
+# Batch endpoint limits. Formulas beyond BATCH_MAX_ITEMS are refused, and at
+# most BATCH_IN_FLIGHT formulas are handed to the engine ahead of the results
+# the client has read, so a slow reader throttles the engine and the upload.
+app.config["BATCH_MAX_ITEMS"] = int(os.environ.get("IUPAC_BATCH_MAX_ITEMS", 10000))
+app.config["BATCH_IN_FLIGHT"] = int(os.environ.get("IUPAC_BATCH_IN_FLIGHT", 256))
+
+# Per-item error messages for the engine's batch statuses
+BATCH_STATUS_ERRORS = {"budget_exceeded": "budget exceeded", "no_name": "no name"}
+
+def engine_command(*mode):
+    return ["./toolkitnew", *mode,
+            "--max-steps", str(ENGINE_MAX_STEPS),
+            "--deadline-ms", str(ENGINE_DEADLINE_MS),
+            "--name-cache", ENGINE_NAME_CACHE]
+
 @app.route('/')
 def home():
     return render_template("home.html")
@@ -11,15 +44,234 @@ def home():
 def toolkit_page():
     return render_template("index.html")
 
+class SingleFlight:
+    """Coalesces concurrent calls with the same key: the first caller runs
+    the function, callers arriving while it is in flight wait for it and
+    share its result (or exception)."""
+
+    class Call:
+        def __init__(self):
+            self.done = threading.Event()
+            self.result = None
+            self.error = None
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.calls = {}
+        self.requests = 0
+        self.executions = 0
+
+    def do(self, key, function):
+        with self.lock:
+            self.requests += 1
+            call = self.calls.get(key)
+            leader = call is None
+            if leader:
+                call = self.calls[key] = SingleFlight.Call()
+                self.executions += 1
+        if leader:
+            try:
+                call.result = function()
+            except Exception as e:
+                call.error = e
+            finally:
+                with self.lock:
+                    del self.calls[key]
+                call.done.set()
+        else:
+            call.done.wait()
+        if call.error is not None:
+            raise call.error
+        return call.result
+
+    def metrics(self):
+        with self.lock:
+            coalesced = self.requests - self.executions
+            return {"requests": self.requests,
+                    "engine_runs": self.executions,
+                    "coalesced": coalesced,
+                    "coalescing_ratio": coalesced / self.requests if self.requests else 0.0,
+                    "in_flight": len(self.calls)}
+
+# Identical /get_iupac requests in flight at the same time share one engine run
+iupac_flights = SingleFlight()
+
+def normalized_formula(formula):
+    # Matches the engine's own cache key: the formula without whitespace
+    return "".join(formula.split())
+
+def run_engine(formula):
+    result = subprocess.run(engine_command(), input=formula.encode(), capture_output=True, timeout=ENGINE_TIMEOUT_S)
+    return result.returncode, result.stdout.decode()
+
 @app.route('/get_iupac', methods=['POST'])
 def get_iupac():
-    formula = request.json['formula']
+    body = request.get_json(silent=True)
+    formula = validate_formula(body.get("formula") if isinstance(body, dict) else None)
+    if isinstance(formula, ValueError):
+        return jsonify({"error": str(formula)}), 400
+    formula = normalized_formula(formula)
     try:
-        result = subprocess.run(["./toolkitnew"], input=formula.encode(), capture_output=True, timeout=5)
-        output = result.stdout.decode()
+        returncode, output = iupac_flights.do(formula, lambda: run_engine(formula))
+        if returncode == EXIT_BUDGET_EXCEEDED:
+            return jsonify({"error": "budget exceeded", "output": output})
         return jsonify({"output": output})
     except Exception as e:
         return jsonify({"error": str(e)})
 
+@app.route('/metrics')
+def metrics():
+    return jsonify({"get_iupac": iupac_flights.metrics()})
+
+def ndjson_items(stream):
+    """Formulas of an NDJSON body (one JSON string or {"formula": ...} per
+    line), read lazily as the engine takes them"""
+    for line in stream:
+        line = line.strip()
+        if not line:
+            continue
+        try:
+            item = json.loads(line)
+        except ValueError:
+            yield ValueError("invalid JSON")
+            continue
+        yield item.get("formula") if isinstance(item, dict) else item
+
+def validate_formula(item):
+    if isinstance(item, ValueError):
+        return item
+    if not isinstance(item, str) or not item.strip():
+        return ValueError("formula must be a non-empty string")
+    if "\n" in item or "\r" in item:
+        return ValueError("formula must be a single line")
+    return item.strip()
+
+def stream_batch(items, max_items, in_flight):
+    """Runs one engine in batch mode over `items` and yields one NDJSON line
+    per item, in order. A feeder thread writes formulas to the engine and a
+    reader thread collects its result lines while this generator pairs them
+    up; the bounded `pending` queue between feeder and generator is the
+    backpressure. Invalid items and items the engine could not finish get an
+    "error" field instead of stopping the batch."""
+    engine = subprocess.Popen(engine_command("--batch", "--stream"), stdin=subprocess.PIPE,
+                              stdout=subprocess.PIPE, bufsize=1, universal_newlines=True)
+    pending = queue.Queue(maxsize=in_flight)
+    results = queue.Queue()
+    # Formulas written to the engine and result lines read back; the engine
+    # owes work while written > received, and `since` is when it last
+    # answered (or when it was last handed work while owing none)
+    state = {"written": 0, "received": 0, "since": time.monotonic(), "stopped": False}
+    lock = threading.Lock()
+    DONE = object()
+
+    def feed():
+        alive = True
+        try:
+            for index, item in enumerate(items):
+                if index >= max_items:
+                    pending.put((index, ValueError("batch exceeds %d formulas" % max_items), False))
+                    break
+                formula = validate_formula(item)
+                sent = alive and not isinstance(formula, ValueError)
+                pending.put((index, formula, sent))
+                if state["stopped"]:
+                    break
+                if not sent:
+                    continue
+                with lock:
+                    if state["written"] == state["received"]:
+                        state["since"] = time.monotonic()
+                    state["written"] += 1
+                try:
+                    engine.stdin.write(formula + "\n")
+                    engine.stdin.flush()
+                except (OSError, ValueError):
+                    alive = False  # the engine died; every later formula is reported as failed
+        finally:
+            pending.put((None, DONE, False))
+            try:
+                engine.stdin.close()
+            except OSError:
+                pass
+
+    def read():
+        for line in iter(engine.stdout.readline, ""):
+            with lock:
+                state["received"] += 1
+                state["since"] = time.monotonic()
+            results.put(line)
+        results.put(None)
+
+    def watchdog():
+        # The engine stops itself per formula; this only catches a hung
+        # process. Only time the engine owes a result counts, so a slow
+        # client or a pause in an NDJSON upload never looks like a hang.
+        while engine.poll() is None:
+            time.sleep(0.5)
+            with lock:
+                hung = state["written"] > state["received"] and time.monotonic() - state["since"] > ENGINE_TIMEOUT_S
+            if hung:
+                engine.kill()
+                return
+
+    for target in (feed, read, watchdog):
+        threading.Thread(target=target, daemon=True).start()
+    engine_failed = False
+    try:
+        while True:
+            index, formula, sent = pending.get()
+            if formula is DONE:
+                break
+            if isinstance(formula, ValueError):
+                yield json.dumps({"index": index, "error": str(formula)}) + "\n"
+                continue
+            line = results.get() if sent and not engine_failed else None
+            if not line:
+                engine_failed = True
+                yield json.dumps({"index": index, "formula": formula, "error": "engine failed"}) + "\n"
+                continue
+            # Engine lines are JSON objects; the index (and error) are spliced
+            # in as text so the server never re-encodes a result
+            extra = ',"index":%d' % index
+            if '"status":"ok"' not in line:
+                status = json.loads(line).get("status")
+                extra += ',"error":%s' % json.dumps(BATCH_STATUS_ERRORS.get(status, status))
+            yield line.rstrip()[:-1] + extra + "}\n"
+    finally:
+        # A client that went away leaves the feeder blocked on the full
+        # queue: drain it so the feeder stops and closes the engine's input.
+        # The engine then finishes by itself, which matters while it creates
+        # the name cache; it is only killed after the engine timeout.
+        state["stopped"] = True
+        while True:
+            try:
+                pending.get_nowait()
+            except queue.Empty:
+                break
+        try:
+            engine.wait(timeout=ENGINE_TIMEOUT_S)
+        except subprocess.TimeoutExpired:
+            engine.kill()
+            engine.wait()
+
+@app.route('/get_iupac_batch', methods=['POST'])
+def get_iupac_batch():
+    """Names many formulas with one engine run. The body is a JSON array (or
+    {"formulas": [...]}) or NDJSON; the response is NDJSON, one object per
+    formula in input order, streamed as the engine produces them."""
+    max_items = app.config["BATCH_MAX_ITEMS"]
+    if request.mimetype == "application/json":
+        body = request.get_json(silent=True)
+        formulas = body.get("formulas") if isinstance(body, dict) else body
+        if not isinstance(formulas, list):
+            return jsonify({"error": "expected a JSON array of formulas"}), 400
+        if len(formulas) > max_items:
+            return jsonify({"error": "batch exceeds %d formulas" % max_items}), 413
+        items = iter(formulas)
+    else:
+        items = ndjson_items(request.stream)
+    generator = stream_batch(items, max_items, app.config["BATCH_IN_FLIGHT"])
+    return Response(stream_with_context(generator), mimetype="application/x-ndjson")
+
 if __name__ == "__main__":
     app.run(debug=True)